@@ -9,6 +9,7 @@
 
 #include <xc.h>
 #include <stdbool.h>
+#include <string.h>
 #include "ff.h"			/* Obtains integer types */
 #include "diskio.h"		/* Declarations of disk functions */
 #include "diskio_hardware.h"
@@ -46,6 +47,14 @@ DSTATUS DiskStat = STA_NOINIT;  /* Disk status */
 bool ejected = false;
 BYTE CardType = 0;              /* Detected card type */
 
+#if FF_FS_READONLY == 0 && MMC_WB_SECTORS
+static BYTE WbBuf[MMC_WB_SECTORS][512]; /* Write-behind queue */
+static LBA_t WbSect[MMC_WB_SECTORS];    /* Sector number of each queued block */
+static BYTE WbCount = 0;                /* Number of queued blocks */
+static volatile BYTE WbTimer = 0;       /* Ticks left until the queued blocks are written */
+static DRESULT MMC_WB_Flush(void);
+#endif
+
 
 void MMC_Init(void)
 {
@@ -87,6 +96,10 @@ void MMC_Interrupt(void)
 
 void MMC_Eject(void)
 {
+#if FF_FS_READONLY == 0 && MMC_WB_SECTORS
+    if(!(DiskStat & STA_NOINIT))
+        MMC_WB_Flush();     /* Write the queued blocks before release the card */
+#endif
     DiskStat = STA_NOINIT | STA_NODISK;
     MMC_ChipEnable(false);
     ejected = true;
@@ -267,12 +280,18 @@ int MMC_ReceiveDataBlock(BYTE *buff, UINT btr)
 int MMC_SendDataBlock(const BYTE *buff, BYTE token)
 {
 	BYTE resp;
+	UINT n;
 
 	if(!MMC_wait_ready(500)) return 0;
 
 	MMC_SendSPI(token);					/* Xmit data token */
 	if (token != 0xFD) {	/* Is data token */
-		MMC_SendBytesSPI(buff, 512);		/* Xmit the data block to the MMC */
+		if (buff) {
+			MMC_SendBytesSPI(buff, 512);	/* Xmit the data block to the MMC */
+		} else {
+			for (n = 512; n; n--)			/* or a block of zero */
+				MMC_SendSPI(0x00);
+		}
 		MMC_SendSPI(0xFF);					/* CRC (Dummy) */
 		MMC_SendSPI(0xFF);
 		resp = MMC_SendSPI(0xFF);			/* Reveive data response */
@@ -361,6 +380,9 @@ DSTATUS disk_initialize (
 	}
 	CardType = ty;
 	MMC_deselect();
+#if FF_FS_READONLY == 0 && MMC_WB_SECTORS
+	WbCount = 0;		/* Discard the blocks queued for previous card */
+#endif
 
 	if (ty) {			/* Initialization succeded */
 		DiskStat &= ~STA_NOINIT;		/* Clear STA_NOINIT */
@@ -380,6 +402,13 @@ DRESULT disk_read (
 	UINT count		/* Number of sectors to read */
 )
 {
+#if FF_FS_READONLY == 0 && MMC_WB_SECTORS
+    BYTE i;
+    BYTE *dp = buff;
+    LBA_t sc = sector;
+    UINT cnt = count;
+#endif
+
     if((pdrv != DEV_MMC) || (count == 0))
         return RES_PARERR;
     if(DiskStat & STA_NOINIT)
@@ -402,32 +431,29 @@ DRESULT disk_read (
 		}
 	}
 	MMC_deselect();
+	if (count > 0)
+		return RES_ERROR;
 
-	return (count > 0) ? RES_ERROR : RES_OK;
+#if FF_FS_READONLY == 0 && MMC_WB_SECTORS
+    for(i = 0; i < WbCount; i++) {  /* Replace blocks still in the queue */
+        if(WbSect[i] - sc < cnt)
+            memcpy(dp + (UINT)(WbSect[i] - sc) * 512, WbBuf[i], 512);
+    }
+    MMC_WB_Poll();
+#endif
+	return RES_OK;
 }
 
 
 
+#if FF_FS_READONLY == 0
+
 /*-----------------------------------------------------------------------*/
-/* Write Sector(s)                                                       */
+/* Send sector(s) to MMC                                                 */
 /*-----------------------------------------------------------------------*/
 
-#if FF_FS_READONLY == 0
-
-DRESULT disk_write (
-	BYTE pdrv,			/* Physical drive nmuber to identify the drive */
-	const BYTE *buff,	/* Data to be written */
-	LBA_t sector,		/* Start sector in LBA */
-	UINT count			/* Number of sectors to write */
-)
+static DRESULT MMC_WriteSectors(const BYTE *buff, LBA_t sector, UINT count)  /* buff == 0 sends zero */
 {
-    if((pdrv != DEV_MMC) || (count == 0))
-        return RES_PARERR;
-	if(DiskStat & STA_NOINIT)
-        return RES_NOTRDY;
-	if(DiskStat & STA_PROTECT)
-        return RES_WRPRT;
-
 	if(!(CardType & CT_BLOCK))
         sector *= 512;	/* Convert to byte address if needed */
 
@@ -439,7 +465,7 @@ DRESULT disk_write (
 		if(MMC_send_cmd(CMD25, sector) == 0) {	/* WRITE_MULTIPLE_BLOCK */
 			do {
 				if(!MMC_SendDataBlock(buff, 0xFC)) break;
-				buff += 512;
+				if(buff) buff += 512;
 			} while (--count);
 			if (!MMC_SendDataBlock(0, 0xFD))	/* STOP_TRAN token */
 				count = 1;
@@ -450,6 +476,113 @@ DRESULT disk_write (
 	return count ? RES_ERROR : RES_OK;
 }
 
+
+#if MMC_WB_SECTORS
+/*-----------------------------------------------------------------------*/
+/* Write-behind queue                                                    */
+/*-----------------------------------------------------------------------*/
+
+static DRESULT MMC_WB_Flush(void)
+{
+    BYTE i, j, n, d;
+    UINT k;
+    LBA_t s;
+
+    for(i = 0; i + 1 < WbCount; i++) {      /* Sort queued blocks in ascending order of LBA */
+        n = i;
+        for(j = i + 1; j < WbCount; j++) {
+            if(WbSect[j] < WbSect[n])
+                n = j;
+        }
+        if(n != i) {
+            s = WbSect[i]; WbSect[i] = WbSect[n]; WbSect[n] = s;
+            for(k = 0; k < 512; k++) {
+                d = WbBuf[i][k]; WbBuf[i][k] = WbBuf[n][k]; WbBuf[n][k] = d;
+            }
+        }
+    }
+    for(i = 0; i < WbCount; i += n) {       /* Write each run of contiguous blocks at a time */
+        for(n = 1; i + n < WbCount && WbSect[i + n] == WbSect[i] + n; n++)
+            ;
+        if(MMC_WriteSectors(WbBuf[i], WbSect[i], n) != RES_OK)
+            return RES_ERROR;   /* Keep the queue to retry */
+    }
+    WbCount = 0;
+
+    return RES_OK;
+}
+
+void MMC_WB_Tick(void)
+{
+    if(WbTimer)
+        WbTimer--;
+}
+
+bool MMC_WB_Poll(void)
+{
+#if MMC_WB_TIMEOUT
+    if(WbCount && !WbTimer && !(DiskStat & STA_NOINIT))     /* Deadline passed? */
+        return MMC_WB_Flush() == RES_OK;
+#endif
+    return true;
+}
+
+#endif
+
+
+/*-----------------------------------------------------------------------*/
+/* Write Sector(s)                                                       */
+/*-----------------------------------------------------------------------*/
+
+DRESULT disk_write (
+	BYTE pdrv,			/* Physical drive nmuber to identify the drive */
+	const BYTE *buff,	/* Data to be written */
+	LBA_t sector,		/* Start sector in LBA */
+	UINT count			/* Number of sectors to write */
+)
+{
+#if MMC_WB_SECTORS
+    BYTE i;
+#endif
+
+    if((pdrv != DEV_MMC) || (count == 0))
+        return RES_PARERR;
+	if(DiskStat & STA_NOINIT)
+        return RES_NOTRDY;
+	if(DiskStat & STA_PROTECT)
+        return RES_WRPRT;
+
+#if MMC_WB_SECTORS
+    if(count < MMC_WB_SECTORS) {    /* Put short write into the queue */
+        for( ; count; count--, sector++, buff += 512) {
+            for(i = 0; i < WbCount && WbSect[i] != sector; i++)
+                ;
+            if(i == WbCount) {      /* Not in the queue */
+                if(WbCount == MMC_WB_SECTORS && MMC_WB_Flush() != RES_OK)
+                    return RES_ERROR;
+                if(WbCount == 0)
+                    WbTimer = MMC_WB_TIMEOUT;   /* Start deadline timer by the first block */
+                i = WbCount++;
+                WbSect[i] = sector;
+            }
+            memcpy(WbBuf[i], buff, 512);
+        }
+        return MMC_WB_Poll() ? RES_OK : RES_ERROR;
+    }
+    for(i = 0; i < WbCount; ) {     /* Discard queued blocks overwritten by long write */
+        if(WbSect[i] - sector < count) {
+            if(i != --WbCount) {
+                WbSect[i] = WbSect[WbCount];
+                memcpy(WbBuf[i], WbBuf[WbCount], 512);
+            }
+        } else {
+            i++;
+        }
+    }
+#endif
+    return MMC_WriteSectors(buff, sector, count);
+}
+
 #endif
 
 /*-----------------------------------------------------------------------*/
@@ -471,6 +604,10 @@ DRESULT disk_ioctl (
 #if _USE_ERASE
 	DWORD *dp, st, ed;
 #endif
+#if FF_FS_READONLY == 0 && FF_USE_ZEROFILL
+	LBA_t *lp, sc;
+	UINT cnt;
+#endif
     
     if(pdrv != DEV_MMC)
         return RES_PARERR;
@@ -482,6 +619,10 @@ DRESULT disk_ioctl (
 
 	switch (cmd) {
 	case CTRL_SYNC :		// Make sure that no pending write process. Do not remove this or written sector might not left updated. 
+#if FF_FS_READONLY == 0 && MMC_WB_SECTORS
+		if(MMC_WB_Flush() != RES_OK)	// Write the queued blocks
+			break;
+#endif
 		if(MMC_select())
 			return RES_OK;
 		break;
@@ -526,6 +667,33 @@ DRESULT disk_ioctl (
 			}
 		}
 		break;
+
+	case GET_MEDIA_ID :		// Get media identifier (CID of the card, 16 bytes)
+		if ((MMC_send_cmd(CMD10, 0) == 0) && MMC_ReceiveDataBlock(buff, 16))
+			res = RES_OK;
+		break;
+#if FF_FS_READONLY == 0 && FF_USE_ZEROFILL
+	case CTRL_ZERO :		// Fill a block of sectors with zero (LBA_t[2]: start and end sector)
+		lp = buff;
+		if (lp[1] < lp[0]) {
+			res = RES_PARERR;
+			break;
+		}
+#if MMC_WB_SECTORS
+		if (MMC_WB_Flush() != RES_OK)	// Write the queued blocks first not to be written over the zeros
+			break;
+#endif
+		for (sc = lp[0]; ; sc += cnt) {	// Zero blocks in multiple block writes
+			cnt = (lp[1] - sc >= 0x3FFF) ? 0x4000 : (UINT)(lp[1] - sc + 1);
+			if (MMC_WriteSectors(0, sc, cnt) != RES_OK)
+				break;
+			if (lp[1] - sc < cnt) {
+				res = RES_OK;
+				break;
+			}
+		}
+		break;
+#endif
 #if _USE_ERASE
 	case CTRL_ERASE_SECTOR :	// Erase a block of sectors (used when _USE_ERASE == 1) 
 		if (!(CardType & CT_SDC)) break;				// Check if the card is SDC 
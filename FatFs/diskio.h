@@ -50,6 +50,8 @@ DRESULT disk_ioctl (BYTE pdrv, BYTE cmd, void* buff);
 #define GET_SECTOR_SIZE		2	/* Get sector size (needed at FF_MAX_SS != FF_MIN_SS) */
 #define GET_BLOCK_SIZE		3	/* Get erase block size (needed at FF_USE_MKFS == 1) */
 #define CTRL_TRIM			4	/* Inform device that the data on the block of sectors is no longer used (needed at FF_USE_TRIM == 1) */
+#define GET_MEDIA_ID		9	/* Get 16-byte media identifier (used at FF_FS_SOFTMOUNT == 1) */
+#define CTRL_ZERO			15	/* Fill a block of sectors with zero (needed at FF_USE_ZEROFILL == 1) */
 
 #if CMD_FATFS_NOT_USED
 
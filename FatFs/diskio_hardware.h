@@ -33,6 +33,17 @@
 #define MMC_INS_IOCF		(IOCAFbits.IOCAF1)
 #define MMC_IsInserted()	(!MMC_INS_PORT)
 
+// Write-behind queue
+//  MMC_WB_SECTORS: Number of written sectors held in RAM (0:disabled)
+//  MMC_WB_TIMEOUT: Deadline of the queued sectors in unit of MMC_WB_Tick() (0:none)
+// Short writes are held in the queue and written in ascending order of LBA,
+// contiguous ones in a multiple block write, when the queue is full, at
+// CTRL_SYNC (f_sync, f_close) or when the deadline passed. Up to
+// MMC_WB_SECTORS * 512 bytes written before the last f_sync can be lost at
+// power failure. Each sector occupies 516 bytes of RAM.
+#define MMC_WB_SECTORS  0
+#define MMC_WB_TIMEOUT  100
+
 // If Chip enable is implemented, these macro should be implemented
 #define MMC_ChipEnable(on)
 #define MMC_IsChipEnable()  (true)
@@ -43,6 +54,11 @@ void MMC_Interrupt(void);
 void MMC_Eject(void);
 bool MMC_IsEjected(void);
 
+#if MMC_WB_SECTORS
+void MMC_WB_Tick(void);     // call it from periodic timer interrupt (e.g. 10ms)
+bool MMC_WB_Poll(void);     // call it in idle time to write the queue if the deadline passed
+#endif
+
 // need to be mplemented in main.c
 void MMC_AccessLamp(bool on);
 
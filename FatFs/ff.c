@@ -50,6 +50,7 @@
 #define IsDigit(c)		((c) >= '0' && (c) <= '9')
 #define IsSeparator(c)	((c) == '/' || (c) == '\\')
 #define IsTerminator(c)	((UINT)(c) < (FF_USE_LFN ? ' ' : '!'))
+#define IsSameSFN(d, n)	((d)[7] == (n)[7] && (d)[0] == (n)[0] && !memcmp((d), (n), 11))
 #define IsSurrogate(c)	((c) >= 0xD800 && (c) <= 0xDFFF)
 #define IsSurrogateH(c)	((c) >= 0xD800 && (c) <= 0xDBFF)
 #define IsSurrogateL(c)	((c) >= 0xDC00 && (c) <= 0xDFFF)
@@ -292,6 +293,149 @@ typedef struct {	/* Open object identifier with status */
 #endif
 
 
+/* End-of-chain hint table */
+#if FF_FS_EOCHINT < 0 || FF_FS_EOCHINT > 16
+#error Wrong FF_FS_EOCHINT setting
+#endif
+
+
+/* Automatic cluster map */
+#if FF_FS_AUTOMAP < 0 || FF_FS_AUTOMAP > 255
+#error Wrong FF_FS_AUTOMAP setting
+#endif
+
+
+/* Directory lookup cache */
+#if FF_FS_DIRCACHE < 0 || FF_FS_DIRCACHE > 16
+#error Wrong FF_FS_DIRCACHE setting
+#endif
+
+
+/* Free entry hint */
+#if FF_FS_DIRHINT < 0 || FF_FS_DIRHINT > 16
+#error Wrong FF_FS_DIRHINT setting
+#endif
+
+
+/* Soft unmount */
+#if FF_FS_SOFTMOUNT != 0 && FF_FS_SOFTMOUNT != 1
+#error Wrong FF_FS_SOFTMOUNT setting
+#endif
+
+
+/* Shared sector buffer pool */
+#if FF_FS_BUFPOOL < 0 || FF_FS_BUFPOOL > 16
+#error Wrong FF_FS_BUFPOOL setting
+#endif
+#if FF_FS_BUFPOOL
+#if FF_FS_TINY
+#error FF_FS_BUFPOOL must be 0 at tiny configuration
+#endif
+#if FF_FS_REENTRANT && FF_VOLUMES > 1
+#error FF_FS_BUFPOOL cannot be used with FF_FS_REENTRANT on multiple volumes
+#endif
+typedef struct {	/* Pooled sector buffer */
+	FIL* owner;		/*  File object using this buffer (NULL:blank entry) */
+	FATFS* fs;		/*  Filesystem object of the owner */
+	WORD id;		/*  Volume mount ID of the owner */
+	WORD age;		/*  Time stamp of the last use */
+	BYTE pin;		/*  Buffer is lent out by f_reserve and cannot be evicted */
+	BYTE buf[FF_MAX_SS];	/* Sector buffer */
+} BUFSLOT;
+#endif
+
+
+/* Sequential read-ahead */
+#if FF_FS_READAHEAD < 0 || FF_FS_READAHEAD == 1 || FF_FS_READAHEAD > 16
+#error Wrong FF_FS_READAHEAD setting
+#endif
+#if FF_FS_READAHEAD
+#if FF_FS_TINY
+#error FF_FS_READAHEAD must be 0 at tiny configuration
+#endif
+#if FF_FS_REENTRANT && FF_VOLUMES > 1
+#error FF_FS_READAHEAD cannot be used with FF_FS_REENTRANT on multiple volumes
+#endif
+typedef struct {	/* Read-ahead buffer */
+	FATFS* fs;		/*  Filesystem object of the file (NULL:blank) */
+	WORD id;		/*  Volume mount ID of the file */
+	DWORD sclust;	/*  Top cluster of the file */
+	LBA_t sect;		/*  Top sector in the buffer */
+	UINT nsect;		/*  Number of sectors in the buffer */
+	BYTE buf[FF_FS_READAHEAD * FF_MAX_SS];	/* Sector buffer */
+} RABUF;
+#endif
+
+
+/* Extent merging */
+#if FF_FS_EXTENT < 0 || FF_FS_EXTENT > 2
+#error Wrong FF_FS_EXTENT setting
+#endif
+
+
+/* Batched directory update */
+#if FF_FS_SYNCBATCH != 0 && FF_FS_SYNCBATCH != 1
+#error Wrong FF_FS_SYNCBATCH setting
+#endif
+#if FF_FS_SYNCBATCH && FF_FS_READONLY
+#error FF_FS_SYNCBATCH must be 0 at read-only configuration
+#endif
+
+
+/* Zero-fill by the device */
+#if FF_USE_ZEROFILL != 0 && FF_USE_ZEROFILL != 1
+#error Wrong FF_USE_ZEROFILL setting
+#endif
+
+
+/* Group commit */
+#if FF_USE_SYNCSET && FF_FS_READONLY
+#error FF_USE_SYNCSET must be 0 at read-only configuration
+#endif
+
+
+/* Record log */
+#if FF_USE_RECLOG && (FF_FS_READONLY || FF_FS_MINIMIZE != 0)
+#error FF_USE_RECLOG needs FF_FS_READONLY == 0 and FF_FS_MINIMIZE == 0
+#endif
+
+
+/* Log ring */
+#if FF_USE_LOGRING && (FF_FS_READONLY || FF_FS_MINIMIZE != 0 || !FF_USE_EXPAND)
+#error FF_USE_LOGRING needs FF_FS_READONLY == 0, FF_FS_MINIMIZE == 0 and FF_USE_EXPAND == 1
+#endif
+
+
+/* Append journal */
+#if FF_USE_JOURNAL && (FF_FS_READONLY || FF_FS_MINIMIZE != 0 || !FF_USE_EXPAND)
+#error FF_USE_JOURNAL needs FF_FS_READONLY == 0, FF_FS_MINIMIZE == 0 and FF_USE_EXPAND == 1
+#endif
+
+
+/* Bulk directory scan */
+#if FF_USE_DIRSCAN && FF_FS_MINIMIZE > 1
+#error FF_USE_DIRSCAN needs FF_FS_MINIMIZE <= 1
+#endif
+#if FF_USE_FINDTIME < 0 || FF_USE_FINDTIME > 2
+#error Wrong FF_USE_FINDTIME setting
+#endif
+#if FF_USE_FINDTIME && FF_FS_MINIMIZE > 1
+#error FF_USE_FINDTIME needs FF_FS_MINIMIZE <= 1
+#endif
+#if FF_FS_LAZYFREE && FF_FS_READONLY
+#error FF_FS_LAZYFREE needs FF_FS_READONLY == 0
+#endif
+
+
+/* Directory index */
+#if FF_USE_DIRINDEX < 0 || FF_USE_DIRINDEX > 8
+#error Wrong FF_USE_DIRINDEX setting
+#endif
+#if FF_USE_DIRINDEX && (FF_FS_READONLY || FF_FS_MINIMIZE != 0 || !FF_USE_EXPAND || FF_USE_LFN)
+#error FF_USE_DIRINDEX needs FF_FS_READONLY == 0, FF_FS_MINIMIZE == 0, FF_USE_EXPAND == 1 and FF_USE_LFN == 0
+#endif
+
+
 /* SBCS up-case tables (\x80-\xFF) */
 #define TBL_CT437  {0x80,0x9A,0x45,0x41,0x8E,0x41,0x8F,0x80,0x45,0x45,0x45,0x49,0x49,0x49,0x8E,0x8F, \
 					0x90,0x92,0x92,0x4F,0x99,0x4F,0x55,0x55,0x59,0x99,0x9A,0x9B,0x9C,0x9D,0x9E,0x9F, \
@@ -464,6 +608,9 @@ typedef struct {	/* Open object identifier with status */
 #endif
 static FATFS *FatFs[FF_VOLUMES];	/* Pointer to the filesystem objects (logical drives) */
 static WORD Fsid;					/* Filesystem mount ID */
+#if FF_FS_SOFTMOUNT
+static FATFS *SoftFs[FF_VOLUMES];	/* Pointer to the filesystem objects unmounted with volume state kept */
+#endif
 
 #if FF_FS_RPATH != 0
 static BYTE CurrVol;				/* Current drive number set by f_chdrive() */
@@ -477,6 +624,15 @@ static volatile BYTE SysLockVolume;	/* Volume id who is locking Files[] */
 #endif
 #endif
 
+#if FF_FS_BUFPOOL
+static BUFSLOT BufPool[FF_FS_BUFPOOL];	/* Shared sector buffers for file objects */
+static WORD BpAge;					/* Time stamp counter of the buffer pool */
+#endif
+
+#if FF_FS_READAHEAD
+static RABUF RaBuf;					/* Read-ahead buffer */
+#endif
+
 #if FF_STR_VOLUME_ID
 #ifdef FF_VOLUME_STRS
 static const char *const VolumeStr[FF_VOLUMES] = {FF_VOLUME_STRS};	/* Pre-defined volume ID */
@@ -1117,7 +1273,7 @@ static FRESULT sync_fs (	/* Returns FR_OK or FR_DISK_ERR */
 
 	res = sync_window(fs);
 	if (res == FR_OK) {
-		if (fs->fsi_flag == 1) {	/* Allocation changed? */
+		if ((fs->fsi_flag & 0x81) == 1) {	/* Allocation changed? */
 			fs->fsi_flag = 0;
 			if (fs->fs_type == FS_FAT32) {	/* FAT32: Update FSInfo sector */
 				/* Create FSInfo structure */
@@ -1169,6 +1325,113 @@ static LBA_t clst2sect (	/* !=0:Sector number, 0:Failed (invalid cluster#) */
 
 
 
+#if FF_FS_BUFPOOL
+/*-----------------------------------------------------------------------*/
+/* Buffer pool - Attach a pooled sector buffer to the file object        */
+/*-----------------------------------------------------------------------*/
+
+static FRESULT bpool_attach (	/* FR_OK(0):succeeded, !=0:error */
+	FIL* fp,		/* Pointer to the file object */
+	int load		/* 0:Do not restore the current sector, 1:Restore it if needed */
+)
+{
+	UINT i, n;
+	FIL *ofp;
+	BUFSLOT *bp;
+
+
+	for (i = 0; i < FF_FS_BUFPOOL && BufPool[i].owner != fp; i++) ;	/* Find the buffer of the file */
+	if (i < FF_FS_BUFPOOL) {	/* The file has a buffer */
+		bp = &BufPool[i];
+	} else {					/* The file has no buffer */
+		for (i = n = 0; n < FF_FS_BUFPOOL; n++) {	/* Select a blank or the least recently used buffer */
+			if (!BufPool[n].owner) {
+				i = n; break;
+			}
+			if (!BufPool[n].pin && (BufPool[i].pin || (WORD)(BpAge - BufPool[n].age) > (WORD)(BpAge - BufPool[i].age))) i = n;
+		}
+		bp = &BufPool[i];
+		ofp = bp->owner;
+		if (ofp) {				/* Evict the buffer from current owner */
+			if (bp->pin) return FR_NOT_ENOUGH_CORE;	/* All buffers are lent out */
+			if (bp->fs->fs_type != 0 && bp->fs->id == bp->id) {	/* Is the owner still alive? */
+#if !FF_FS_READONLY
+				if (ofp->flag & FA_DIRTY) {	/* Write-back dirty cached data */
+					if (disk_write(bp->fs->pdrv, bp->buf, ofp->sect, 1) != RES_OK) return FR_DISK_ERR;
+					ofp->flag &= (BYTE)~FA_DIRTY;
+				}
+#endif
+				ofp->buf = 0;
+			}
+		}
+		bp->owner = fp;
+		bp->fs = fp->obj.fs; bp->id = fp->obj.id;
+		bp->pin = 0;
+		fp->buf = bp->buf;
+		if (load && fp->sect != 0 && fp->fptr % SS(fp->obj.fs) != 0) {	/* Restore the current sector if in the middle of sector */
+			if (disk_read(fp->obj.fs->pdrv, bp->buf, fp->sect, 1) != RES_OK) {
+				fp->err = FR_DISK_ERR;
+				return FR_DISK_ERR;
+			}
+		} else {
+			memset(bp->buf, 0, sizeof bp->buf);	/* Clear sector buffer */
+			fp->sect = 0;		/* Invalidate current data sector */
+		}
+	}
+	bp->age = ++BpAge;	/* Update time stamp */
+
+	return FR_OK;
+}
+
+
+
+
+/*-----------------------------------------------------------------------*/
+/* Buffer pool - Release pooled sector buffers                           */
+/*-----------------------------------------------------------------------*/
+
+static void bpool_release (
+	FIL* fp,		/* Release the buffer of this file object (NULL:all files on the volume) */
+	FATFS* fs		/* Filesystem object */
+)
+{
+	UINT i;
+
+
+	for (i = 0; i < FF_FS_BUFPOOL; i++) {
+		if (fp ? BufPool[i].owner == fp : BufPool[i].fs == fs) {
+			BufPool[i].owner = 0;
+			BufPool[i].fs = 0;
+			BufPool[i].pin = 0;
+		}
+	}
+	if (fp) fp->buf = 0;
+}
+
+
+#if FF_USE_RESERVE && !FF_FS_READONLY
+/*-----------------------------------------------------------------------*/
+/* Buffer pool - Pin/Unpin the buffer of the file object                 */
+/*-----------------------------------------------------------------------*/
+
+static void bpool_pin (
+	FIL* fp,		/* Pointer to the file object */
+	BYTE pin		/* 0:Allow eviction, 1:Block eviction */
+)
+{
+	UINT i;
+
+
+	for (i = 0; i < FF_FS_BUFPOOL; i++) {
+		if (BufPool[i].owner == fp) BufPool[i].pin = pin;
+	}
+}
+#endif
+
+#endif	/* FF_FS_BUFPOOL */
+
+
+
 
 /*-----------------------------------------------------------------------*/
 /* FAT access - Read value of an FAT entry                               */
@@ -1437,6 +1700,115 @@ static FRESULT fill_last_frag (
 
 
 
+#if !FF_FS_READONLY && FF_FS_LAZYFREE
+/*-----------------------------------------------------------------------*/
+/* FAT handling - Lazy allocation information                            */
+/*-----------------------------------------------------------------------*/
+
+static void load_fsinfo (	/* Load the FSInfo deferred at mount */
+	FATFS* fs			/* Filesystem object */
+)
+{
+	fs->fsi_flag &= (BYTE)~0x40;
+	if (move_window(fs, fs->volbase + 1) != FR_OK) {	/* FSInfo is next to VBR */
+		fs->fsi_flag = 0x80;		/* Disable FSInfo */
+		return;
+	}
+	if (   ld_dword(fs->win + FSI_LeadSig) == 0x41615252
+		&& ld_dword(fs->win + FSI_StrucSig) == 0x61417272
+		&& ld_dword(fs->win + FSI_TrailSig) == 0xAA550000)
+	{
+#if (FF_FS_NOFSINFO & 1) == 0	/* Get free cluster count if trust it and allocation is not changed yet */
+		if (!(fs->fsi_flag & 1)) fs->free_clst = ld_dword(fs->win + FSI_Free_Count);
+#endif
+#if (FF_FS_NOFSINFO & 2) == 0	/* Get next free cluster if rtust it and not set yet */
+		if (fs->last_clst == 0xFFFFFFFF) fs->last_clst = ld_dword(fs->win + FSI_Nxt_Free);
+#endif
+	}
+	if (fs->free_clst <= fs->n_fatent - 2) fs->fr_clst = 0;	/* No need to count free clusters */
+}
+
+
+static void free_track (	/* Reflect an allocation change to the free clusters being counted */
+	FATFS* fs,			/* Filesystem object */
+	DWORD clst,			/* Top of the cluster block */
+	DWORD ncl,			/* Number of clusters in the block */
+	int alloc			/* 1:allocated, 0:freed */
+)
+{
+	DWORD n;
+
+
+	if (fs->fsi_flag & 0x40) fs->fsi_flag |= 1;	/* FSInfo not loaded yet gets outdated */
+	if (clst < fs->fr_clst) {	/* Is the block (partly) in the area already counted? */
+		n = fs->fr_clst - clst;
+		if (n > ncl) n = ncl;
+		if (alloc) {
+			fs->fr_cnt -= n;
+		} else {
+			fs->fr_cnt += n;
+		}
+	}
+}
+
+
+static FRESULT free_step (	/* Count free clusters in nsect sectors of the FAT or bitmap */
+	FATFS* fs,			/* Filesystem object */
+	UINT nsect			/* Number of sectors to be processed (0:until completed) */
+)
+{
+	FRESULT res = FR_OK;
+	FFOBJID obj;
+	DWORD clst, stat;
+	UINT i, e;
+
+
+	if (fs->fsi_flag & 0x40) load_fsinfo(fs);	/* The count may be available in the FSInfo */
+	clst = fs->fr_clst;
+	if (clst == 0) return FR_OK;	/* Not counting */
+	do {
+#if FF_FS_EXFAT
+		if (fs->fs_type == FS_EXFAT) {	/* exFAT: Count clear bits in a sector of the bitmap */
+			res = move_window(fs, fs->bitbase + (clst - 2) / (SS(fs) * 8));
+			if (res == FR_OK) {
+				for (i = (clst - 2) % (SS(fs) * 8); i < SS(fs) * 8 && clst < fs->n_fatent; i++, clst++) {
+					if (!(fs->win[i / 8] & (1 << i % 8))) fs->fr_cnt++;
+				}
+			}
+		} else
+#endif
+		if (fs->fs_type == FS_FAT12) {	/* FAT12: Count free entries in about a sector of the FAT */
+			obj.fs = fs;
+			for (i = 0; i < SS(fs) && clst < fs->n_fatent; i++, clst++) {
+				stat = get_fat(&obj, clst);
+				if (stat == 0xFFFFFFFF) { res = FR_DISK_ERR; break; }
+				if (stat == 1) { res = FR_INT_ERR; break; }
+				if (stat == 0) fs->fr_cnt++;
+			}
+		} else {	/* FAT16/32: Count free entries in a sector of the FAT */
+			e = (fs->fs_type == FS_FAT16) ? 2 : 4;	/* Size of an entry */
+			res = move_window(fs, fs->fatbase + clst / (SS(fs) / e));
+			if (res == FR_OK) {
+				for (i = clst % (SS(fs) / e) * e; i < SS(fs) && clst < fs->n_fatent; i += e, clst++) {
+					if (((e == 2) ? ld_word(fs->win + i) : ld_dword(fs->win + i) & 0x0FFFFFFF) == 0) fs->fr_cnt++;
+				}
+			}
+		}
+		fs->fr_clst = clst;		/* Counted so far */
+	} while (res == FR_OK && clst < fs->n_fatent && (nsect == 0 || --nsect != 0));
+
+	if (res == FR_OK && clst >= fs->n_fatent) {	/* Completed? */
+		fs->free_clst = fs->fr_cnt;	/* Now free cluster count is valid */
+		fs->fr_clst = 0;
+		fs->fsi_flag |= 1;
+	}
+	return res;
+}
+
+#endif	/* !FF_FS_READONLY && FF_FS_LAZYFREE */
+
+
+
 #if !FF_FS_READONLY
 /*-----------------------------------------------------------------------*/
 /* FAT handling - Remove a cluster chain                                 */
@@ -1457,8 +1829,26 @@ static FRESULT remove_chain (	/* FR_OK(0):succeeded, !=0:error */
 #if FF_USE_TRIM
 	LBA_t rt[2];
 #endif
+#if FF_USE_DIRINDEX
+	UINT i;
+#endif
 
 	if (clst < 2 || clst >= fs->n_fatent) return FR_INT_ERR;	/* Check if in valid range */
+#if FF_FS_LAZYFREE
+	if (fs->fsi_flag & 0x40) load_fsinfo(fs);	/* Get allocation information prior to the first change */
+#endif
+
+#if FF_FS_EOCHINT
+	memset(fs->eoch, 0, sizeof fs->eoch);	/* Discard end-of-chain hints because any chain is going to be changed */
+#endif
+#if FF_FS_READAHEAD
+	if (RaBuf.fs == fs) RaBuf.fs = 0;	/* Discard read-ahead data because the clusters can be reused by another file */
+#endif
+#if FF_USE_DIRINDEX
+	for (i = 0; pclst == 0 && i < FF_USE_DIRINDEX; i++) {	/* Drop the index of the directory being removed */
+		if (fs->didx[i].dclust == clst) fs->didx[i].sect = 0;
+	}
+#endif
 
 	/* Mark the previous cluster 'EOC' on the FAT if it exists */
 	if (pclst != 0 && (!FF_FS_EXFAT || fs->fs_type != FS_EXFAT || obj->stat != 2)) {
@@ -1480,6 +1870,9 @@ static FRESULT remove_chain (	/* FR_OK(0):succeeded, !=0:error */
 			fs->free_clst++;
 			fs->fsi_flag |= 1;
 		}
+#if FF_FS_LAZYFREE
+		free_track(fs, clst, 1, 0);
+#endif
 #if FF_FS_EXFAT || FF_USE_TRIM
 		if (ecl + 1 == nxt) {	/* Is next cluster contiguous? */
 			ecl = nxt;
@@ -1547,6 +1940,9 @@ static DWORD create_chain (	/* 0:No free cluster, 1:Internal error, 0xFFFFFFFF:D
 	FATFS *fs = obj->fs;
 
 
+#if FF_FS_LAZYFREE
+	if (fs->fsi_flag & 0x40) load_fsinfo(fs);	/* Get allocation information prior to the first allocation */
+#endif
 	if (clst == 0) {	/* Create a new chain */
 		scl = fs->last_clst;				/* Suggested cluster to start to find */
 		if (scl == 0 || scl >= fs->n_fatent) scl = 1;
@@ -1625,6 +2021,9 @@ static DWORD create_chain (	/* 0:No free cluster, 1:Internal error, 0xFFFFFFFF:D
 			fs->free_clst--;
 			fs->fsi_flag |= 1;
 		}
+#if FF_FS_LAZYFREE
+		free_track(fs, ncl, 1, 1);
+#endif
 	} else {
 		ncl = (res == FR_DISK_ERR) ? 0xFFFFFFFF : 1;	/* Failed. Generate error status */
 	}
@@ -1637,79 +2036,489 @@ static DWORD create_chain (	/* 0:No free cluster, 1:Internal error, 0xFFFFFFFF:D
 
 
 
-#if FF_USE_FASTSEEK
+#if !FF_FS_READONLY && FF_FS_EOCHINT
 /*-----------------------------------------------------------------------*/
-/* FAT handling - Convert offset into cluster with link map table        */
+/* FAT handling - Find/Store last cluster in the end-of-chain hint table */
 /*-----------------------------------------------------------------------*/
 
-static DWORD clmt_clust (	/* <2:Error, >=2:Cluster number */
-	FIL* fp,		/* Pointer to the file object */
-	FSIZE_t ofs		/* File offset to be converted to cluster# */
+static DWORD eoch_find (	/* 0:Not found, >=2:Last cluster of the file */
+	FATFS* fs,		/* Filesystem object */
+	LBA_t dsect,	/* Sector containing the directory entry */
+	UINT dofs,		/* Offset of the directory entry in the sector */
+	DWORD sclust,	/* Start cluster in the directory entry */
+	FSIZE_t fsize	/* File size in the directory entry */
 )
 {
-	DWORD cl, ncl;
-	DWORD *tbl;
-	FATFS *fs = fp->obj.fs;
+	UINT i;
+	FFEOCH *hp;
 
 
-	tbl = fp->cltbl + 1;	/* Top of CLMT */
-	cl = (DWORD)(ofs / SS(fs) / fs->csize);	/* Cluster order from top of the file */
-	for (;;) {
-		ncl = *tbl++;			/* Number of cluters in the fragment */
-		if (ncl == 0) return 0;	/* End of table? (error) */
-		if (cl < ncl) break;	/* In this fragment? */
-		cl -= ncl; tbl++;		/* Next fragment */
+	for (i = 0; i < FF_FS_EOCHINT; i++) {
+		hp = &fs->eoch[i];
+		if (hp->dsect == dsect && hp->dofs == dofs) {	/* Is it the item of the directory entry? */
+			if (hp->sclust == sclust && hp->fsize == fsize && hp->lclust >= 2 && hp->lclust < fs->n_fatent) {	/* Is the hint still valid? */
+				return hp->lclust;
+			}
+			break;
+		}
 	}
-	return cl + *tbl;	/* Return the cluster number */
+	return 0;
 }
 
-#endif	/* FF_USE_FASTSEEK */
+
+static void eoch_store (
+	FATFS* fs,		/* Filesystem object */
+	LBA_t dsect,	/* Sector containing the directory entry */
+	UINT dofs,		/* Offset of the directory entry in the sector */
+	DWORD sclust,	/* Start cluster of the file */
+	FSIZE_t fsize,	/* File size */
+	DWORD lclust	/* Last cluster of the file */
+)
+{
+	UINT i;
+	FFEOCH *hp;
+
+
+	for (i = 0; i < FF_FS_EOCHINT && (fs->eoch[i].dsect != dsect || fs->eoch[i].dofs != dofs); i++) ;	/* Find the item of the directory entry */
+	if (i == FF_FS_EOCHINT) {	/* Not found, replace the oldest item */
+		i = fs->eoch_idx;
+		fs->eoch_idx = (BYTE)((i + 1) % FF_FS_EOCHINT);
+	}
+	hp = &fs->eoch[i];
+	hp->dsect = dsect;
+	hp->dofs = (WORD)dofs;
+	hp->sclust = sclust;
+	hp->fsize = fsize;
+	hp->lclust = lclust;
+}
+
+#endif	/* !FF_FS_READONLY && FF_FS_EOCHINT */
 
 
 
 
+#if !FF_FS_READONLY && (FF_USE_EXPAND || FF_USE_PREALLOC)
 /*-----------------------------------------------------------------------*/
-/* Directory handling - Fill a cluster with zeros                        */
+/* FAT handling - Find a contiguous free cluster block on the FAT        */
 /*-----------------------------------------------------------------------*/
 
-#if !FF_FS_READONLY
-static FRESULT dir_clear (	/* Returns FR_OK or FR_DISK_ERR */
-	FATFS *fs,		/* Filesystem object */
-	DWORD clst		/* Directory table to clear */
+static DWORD find_contig (	/* 0:Not found, 1:Internal error, 0xFFFFFFFF:Disk error, >=2:Top of the block */
+	FFOBJID* obj,	/* Corresponding object */
+	DWORD stcl,		/* Cluster number to start to find */
+	DWORD tcl		/* Number of clusters to be found */
 )
 {
-	LBA_t sect;
-	UINT n, szb;
-	BYTE *ibuf;
+	FATFS *fs = obj->fs;
+	DWORD n, clst, scl, ncl;
 
 
-	if (sync_window(fs) != FR_OK) return FR_DISK_ERR;	/* Flush disk access window */
-	sect = clst2sect(fs, clst);		/* Top of the cluster */
-	fs->winsect = sect;				/* Set window to top of the cluster */
-	memset(fs->win, 0, sizeof fs->win);	/* Clear window buffer */
-#if FF_USE_LFN == 3		/* Quick table clear by using multi-secter write */
-	/* Allocate a temporary buffer */
-	for (szb = ((DWORD)fs->csize * SS(fs) >= MAX_MALLOC) ? MAX_MALLOC : fs->csize * SS(fs), ibuf = 0; szb > SS(fs) && (ibuf = ff_memalloc(szb)) == 0; szb /= 2) ;
-	if (szb > SS(fs)) {		/* Buffer allocated? */
-		memset(ibuf, 0, szb);
-		szb /= SS(fs);		/* Bytes -> Sectors */
-		for (n = 0; n < fs->csize && disk_write(fs->pdrv, ibuf, sect + n, szb) == RES_OK; n += szb) ;	/* Fill the cluster with 0 */
-		ff_memfree(ibuf);
-	} else
-#endif
-	{
-		ibuf = fs->win; szb = 1;	/* Use window buffer (many single-sector writes may take a time) */
-		for (n = 0; n < fs->csize && disk_write(fs->pdrv, ibuf, sect + n, szb) == RES_OK; n += szb) ;	/* Fill the cluster with 0 */
+	if (stcl < 2 || stcl >= fs->n_fatent) stcl = 2;
+	scl = clst = stcl; ncl = 0;
+	for (;;) {	/* Find a contiguous cluster block */
+		n = get_fat(obj, clst);
+		if (++clst >= fs->n_fatent) clst = 2;
+		if (n == 1 || n == 0xFFFFFFFF) return n;	/* Internal error or disk error */
+		if (n == 0) {	/* Is it a free cluster? */
+			if (++ncl == tcl) return scl;	/* Return if a contiguous cluster block is found */
+		} else {
+			scl = clst; ncl = 0;		/* Not a free cluster */
+		}
+		if (clst == stcl) return 0;		/* No contiguous cluster? */
+		if (clst == 2) {				/* A block cannot wrap around the end of FAT */
+			scl = 2; ncl = 0;
+		}
 	}
-	return (n == fs->csize) ? FR_OK : FR_DISK_ERR;
 }
-#endif	/* !FF_FS_READONLY */
+
+#endif
 
 
 
 
+#if !FF_FS_READONLY && FF_USE_PREALLOC
 /*-----------------------------------------------------------------------*/
-/* Directory handling - Set directory index                              */
+/* FAT handling - Get next cluster in streaming mode                     */
+/*-----------------------------------------------------------------------*/
+
+static DWORD pa_next (	/* 0:Disk full, 1:Internal error, 0xFFFFFFFF:Disk error, >=2:Cluster number */
+	FIL* fp				/* File object in streaming mode, fptr is on the cluster boundary */
+)
+{
+	FATFS *fs = fp->obj.fs;
+	DWORD ci, clst, pcl, scl, n;
+	FRESULT res;
+
+
+	ci = (DWORD)(fp->fptr / SS(fs) / fs->csize);	/* Cluster order of the file pointer */
+	if (ci - fp->pa_ci < fp->pa_len) {		/* In the preallocated region? */
+		return fp->pa_top + (ci - fp->pa_ci);
+	}
+	pcl = (ci == 0) ? 0 : fp->clust;		/* Cluster to be followed */
+	clst = (pcl == 0) ? fp->obj.sclust : get_fat(&fp->obj, pcl);
+	if (clst == 1 || clst == 0xFFFFFFFF) return clst;	/* Internal error or disk error */
+	if (clst >= 2 && clst < fs->n_fatent) return clst;	/* Follow the existing chain */
+
+	/* Reached end of the chain, allocate a new contiguous region */
+#if FF_FS_LAZYFREE
+	if (fs->fsi_flag & 0x40) load_fsinfo(fs);
+#endif
+	scl = find_contig(&fp->obj, pcl ? pcl + 1 : fs->last_clst, fp->pa_ncl);
+	if (scl == 1 || scl == 0xFFFFFFFF) return scl;
+	if (scl == 0) return create_chain(&fp->obj, pcl);	/* No contiguous block, stretch the chain a cluster */
+	for (clst = scl, n = fp->pa_ncl, res = FR_OK; res == FR_OK && n; clst++, n--) {	/* Create a cluster chain on the FAT */
+		res = put_fat(fs, clst, (n == 1) ? 0xFFFFFFFF : clst + 1);
+	}
+	if (res == FR_OK && pcl != 0) res = put_fat(fs, pcl, scl);	/* Link it to the chain */
+	if (res != FR_OK) return (res == FR_DISK_ERR) ? 0xFFFFFFFF : 1;
+	fs->last_clst = scl + fp->pa_ncl - 1;	/* Update allocation information */
+	if (fs->free_clst <= fs->n_fatent - 2) {
+		fs->free_clst -= fp->pa_ncl;
+		fs->fsi_flag |= 1;
+	}
+#if FF_FS_LAZYFREE
+	free_track(fs, scl, fp->pa_ncl, 1);
+#endif
+	fp->pa_top = scl; fp->pa_len = fp->pa_ncl; fp->pa_ci = ci; fp->pa_prev = pcl;
+	return scl;
+}
+
+#endif	/* !FF_FS_READONLY && FF_USE_PREALLOC */
+
+
+
+
+#if FF_USE_FASTSEEK
+/*-----------------------------------------------------------------------*/
+/* FAT handling - Convert offset into cluster with link map table        */
+/*-----------------------------------------------------------------------*/
+
+static DWORD clmt_clust (	/* <2:Error, >=2:Cluster number */
+	FIL* fp,		/* Pointer to the file object */
+	FSIZE_t ofs		/* File offset to be converted to cluster# */
+)
+{
+	DWORD cl, ncl;
+	DWORD *tbl;
+	FATFS *fs = fp->obj.fs;
+
+
+	tbl = fp->cltbl + 1;	/* Top of CLMT */
+	cl = (DWORD)(ofs / SS(fs) / fs->csize);	/* Cluster order from top of the file */
+	for (;;) {
+		ncl = *tbl++;			/* Number of cluters in the fragment */
+		if (ncl == 0) return 0;	/* End of table? (error) */
+		if (cl < ncl) break;	/* In this fragment? */
+		cl -= ncl; tbl++;		/* Next fragment */
+	}
+	return cl + *tbl;	/* Return the cluster number */
+}
+
+#endif	/* FF_USE_FASTSEEK */
+
+
+
+
+#if FF_FS_AUTOMAP
+/*-----------------------------------------------------------------------*/
+/* FAT handling - Automatic cluster map of the file                      */
+/*-----------------------------------------------------------------------*/
+
+static void amap_add (
+	FIL* fp,		/* Pointer to the file object */
+	DWORD ci,		/* Cluster order from top of the file */
+	DWORD clst		/* Cluster number */
+)
+{
+	DWORD *tbl;
+
+
+	if (fp->am_stat != 1 || ci != fp->am_ncl) return;	/* Is it the cluster next to the map? */
+	tbl = &fp->am_tbl[fp->am_cnt * 2];
+	if (fp->am_cnt > 0 && tbl[-1] + tbl[-2] == clst) {	/* Contiguous to the last fragment? */
+		tbl[-2]++;
+	} else {
+		if (fp->am_cnt == FF_FS_AUTOMAP) {	/* No room for new fragment, the map ends here */
+			fp->am_stat = 2;
+			return;
+		}
+		tbl[0] = 1; tbl[1] = clst;
+		fp->am_cnt++;
+	}
+	fp->am_ncl++;
+}
+
+
+static DWORD amap_clust (	/* 0:Not in the map, >=2:Cluster number */
+	FIL* fp,		/* Pointer to the file object */
+	DWORD ci		/* Cluster order from top of the file */
+)
+{
+	DWORD *tbl = fp->am_tbl;
+	UINT n;
+
+
+	if (fp->am_stat == 0 || ci >= fp->am_ncl) return 0;
+	for (n = fp->am_cnt; n; n--, tbl += 2) {
+		if (ci < tbl[0]) return tbl[1] + ci;	/* In this fragment? */
+		ci -= tbl[0];
+	}
+	return 0;
+}
+
+
+#if FF_FS_MINIMIZE <= 2
+static FRESULT amap_build (
+	FIL* fp			/* Pointer to the file object */
+)
+{
+	DWORD clst;
+
+
+	fp->am_stat = 1; fp->am_cnt = 0; fp->am_ncl = 0;
+	clst = fp->obj.sclust;
+	while (clst != 0 && clst < fp->obj.fs->n_fatent && fp->am_stat == 1) {	/* Follow the chain until end of chain or end of map */
+		amap_add(fp, fp->am_ncl, clst);
+		clst = get_fat(&fp->obj, clst);
+		if (clst == 1 || clst == 0xFFFFFFFF) {
+			fp->am_stat = 0;
+			return clst == 1 ? FR_INT_ERR : FR_DISK_ERR;
+		}
+	}
+	return FR_OK;
+}
+#endif
+
+#endif	/* FF_FS_AUTOMAP */
+
+
+
+
+#if FF_FS_READAHEAD
+/*-----------------------------------------------------------------------*/
+/* Read-ahead - Load a sector of the file into the sector buffer         */
+/*-----------------------------------------------------------------------*/
+
+static FRESULT rahead_load (	/* FR_OK(0):succeeded, !=0:error */
+	FIL* fp,		/* Pointer to the file object */
+	LBA_t sect,		/* Sector to be loaded (fp->fptr is at top of the sector) */
+	UINT csect		/* Sector offset of the sector in the cluster */
+)
+{
+	FATFS *fs = fp->obj.fs;
+	DWORD clst, nxt, nfs;
+	UINT n;
+
+
+	if (RaBuf.fs != fs || RaBuf.id != fs->id || RaBuf.sclust != fp->obj.sclust || sect - RaBuf.sect >= RaBuf.nsect) {	/* Not in the buffer? */
+		if (csect != 0 && sect != fp->sect + 1) {	/* Random access is not read ahead */
+			return disk_read(fs->pdrv, fp->buf, sect, 1) == RES_OK ? FR_OK : FR_DISK_ERR;
+		}
+		n = fs->csize - csect;		/* Sectors left in the cluster */
+		for (clst = fp->clust; n < FF_FS_READAHEAD; clst = nxt, n += fs->csize) {	/* Extend it while the next cluster is adjacent */
+			nxt = get_fat(&fp->obj, clst);
+			if (nxt == 0xFFFFFFFF) return FR_DISK_ERR;
+			if (nxt != clst + 1) break;
+		}
+		if (n > FF_FS_READAHEAD) n = FF_FS_READAHEAD;
+		nfs = (DWORD)((fp->obj.objsize + SS(fs) - 1) / SS(fs) - fp->fptr / SS(fs));	/* Sectors left in the file */
+		if (n > nfs) n = (UINT)nfs;
+		RaBuf.fs = 0;
+		if (disk_read(fs->pdrv, RaBuf.buf, sect, n) != RES_OK) return FR_DISK_ERR;
+		RaBuf.fs = fs; RaBuf.id = fs->id; RaBuf.sclust = fp->obj.sclust;
+		RaBuf.sect = sect; RaBuf.nsect = n;
+	}
+	memcpy(fp->buf, RaBuf.buf + (UINT)(sect - RaBuf.sect) * SS(fs), SS(fs));	/* Take the sector from the buffer */
+	return FR_OK;
+}
+
+
+#if !FF_FS_READONLY
+/*-----------------------------------------------------------------------*/
+/* Read-ahead - Discard the read-ahead data of the file to be modified   */
+/*-----------------------------------------------------------------------*/
+
+static void rahead_discard (
+	FIL* fp		/* Pointer to the file object */
+)
+{
+	if (RaBuf.fs == fp->obj.fs && RaBuf.sclust == fp->obj.sclust) RaBuf.fs = 0;
+}
+#endif
+
+#endif	/* FF_FS_READAHEAD */
+
+
+
+
+#if !FF_FS_READONLY
+/*-----------------------------------------------------------------------*/
+/* FAT handling - Get cluster to be written at the cluster boundary      */
+/*-----------------------------------------------------------------------*/
+
+static DWORD wr_clust (	/* 0:Disk full, 1:Internal error, 0xFFFFFFFF:Disk error, >=2:Cluster number */
+	FIL* fp				/* Pointer to the file object, fptr is on the cluster boundary */
+)
+{
+	DWORD clst;
+
+
+#if FF_USE_PREALLOC
+	if (fp->pa_ncl != 0) {		/* In streaming mode? */
+		clst = pa_next(fp);		/* Get next cluster in the preallocated region */
+	} else
+#endif
+	if (fp->fptr == 0) {		/* On the top of the file? */
+		clst = fp->obj.sclust;	/* Follow from the origin */
+		if (clst == 0) {		/* If no cluster is allocated, */
+			clst = create_chain(&fp->obj, 0);	/* create a new cluster chain */
+		}
+	} else {					/* On the middle or end of the file */
+#if FF_USE_FASTSEEK
+		if (fp->cltbl) {
+			clst = clmt_clust(fp, fp->fptr);	/* Get cluster# from the CLMT */
+		} else
+#endif
+		{
+			clst = create_chain(&fp->obj, fp->clust);	/* Follow or stretch cluster chain on the FAT */
+		}
+	}
+	if (clst >= 2 && clst != 0xFFFFFFFF && fp->obj.sclust == 0) {
+		fp->obj.sclust = clst;	/* Set start cluster if the first write */
+	}
+	return clst;
+}
+
+#endif	/* !FF_FS_READONLY */
+
+
+
+
+#if FF_FS_EXTENT
+/*-----------------------------------------------------------------------*/
+/* FAT handling - Merge following contiguous clusters into a transfer    */
+/*-----------------------------------------------------------------------*/
+
+static UINT ext_run (	/* Number of sectors to be transferred at a time */
+	FIL* fp,		/* Pointer to the file object (fp->clust is moved to the last cluster merged) */
+	UINT csect,		/* Sector offset of the file pointer in the current cluster */
+	UINT cc,		/* Number of sectors to transfer */
+	int wr			/* 0:Follow the chain, 1:Follow or stretch the chain */
+)
+{
+	FATFS *fs = fp->obj.fs;
+	FSIZE_t ofs;
+	DWORD clst;
+	UINT n;
+
+
+	n = fs->csize - csect;		/* Sectors left in the current cluster */
+#if !FF_FS_READONLY
+	if (wr && FF_FS_EXFAT && fs->fs_type == FS_EXFAT) return n;	/* Stretching a contiguous object is left to the cluster boundary */
+#if FF_USE_PREALLOC
+	if (wr && fp->pa_ncl != 0) return n;	/* Streaming mode allocates the clusters by itself */
+#endif
+#else
+	(void)wr;		/* The chain is never stretched on the read-only configuration */
+#endif
+	ofs = fp->fptr + (FSIZE_t)n * SS(fs);	/* Offset of the next cluster */
+	while (n < cc) {
+#if FF_USE_FASTSEEK
+		if (fp->cltbl) {
+			clst = clmt_clust(fp, ofs);	/* Get cluster# from the CLMT */
+		} else
+#endif
+#if !FF_FS_READONLY
+		if (wr) {
+			clst = create_chain(&fp->obj, fp->clust);	/* Follow or stretch cluster chain */
+		} else
+#endif
+		{
+			clst = get_fat(&fp->obj, fp->clust);	/* Follow cluster chain */
+		}
+		if (clst != fp->clust + 1) break;	/* Not contiguous? (errors are left to the next cluster boundary) */
+		fp->clust = clst;
+#if FF_FS_AUTOMAP && !FF_FS_READONLY
+		if (wr) amap_add(fp, (DWORD)(ofs / SS(fs) / fs->csize), clst);	/* Add the cluster to the map if the chain is stretched */
+#endif
+		n += fs->csize; ofs += (FSIZE_t)fs->csize * SS(fs);
+	}
+	return n < cc ? n : cc;
+}
+
+#endif	/* FF_FS_EXTENT */
+
+
+
+
+#if !FF_FS_READONLY && FF_USE_ZEROFILL
+/*-----------------------------------------------------------------------*/
+/* Fill a block of sectors with zero by the device                       */
+/*-----------------------------------------------------------------------*/
+
+static int disk_zero (	/* 1:Filled, 0:Not supported or failed */
+	BYTE pdrv,		/* Physical drive number */
+	LBA_t sect,		/* Start sector */
+	LBA_t nsect		/* Number of sectors to fill */
+)
+{
+	LBA_t rt[2];
+
+
+	if (nsect == 0) return 1;
+	rt[0] = sect; rt[1] = sect + nsect - 1;	/* Start and end sector of the block */
+	return disk_ioctl(pdrv, CTRL_ZERO, rt) == RES_OK;
+}
+
+#endif	/* !FF_FS_READONLY && FF_USE_ZEROFILL */
+
+
+
+
+/*-----------------------------------------------------------------------*/
+/* Directory handling - Fill a cluster with zeros                        */
+/*-----------------------------------------------------------------------*/
+
+#if !FF_FS_READONLY
+static FRESULT dir_clear (	/* Returns FR_OK or FR_DISK_ERR */
+	FATFS *fs,		/* Filesystem object */
+	DWORD clst		/* Directory table to clear */
+)
+{
+	LBA_t sect;
+	UINT n, szb;
+	BYTE *ibuf;
+
+
+	if (sync_window(fs) != FR_OK) return FR_DISK_ERR;	/* Flush disk access window */
+	sect = clst2sect(fs, clst);		/* Top of the cluster */
+	fs->winsect = sect;				/* Set window to top of the cluster */
+	memset(fs->win, 0, sizeof fs->win);	/* Clear window buffer */
+#if FF_USE_ZEROFILL
+	if (disk_zero(fs->pdrv, sect, fs->csize)) return FR_OK;	/* Fill the cluster with 0 by the device if supported */
+#endif
+#if FF_USE_LFN == 3		/* Quick table clear by using multi-secter write */
+	/* Allocate a temporary buffer */
+	for (szb = ((DWORD)fs->csize * SS(fs) >= MAX_MALLOC) ? MAX_MALLOC : fs->csize * SS(fs), ibuf = 0; szb > SS(fs) && (ibuf = ff_memalloc(szb)) == 0; szb /= 2) ;
+	if (szb > SS(fs)) {		/* Buffer allocated? */
+		memset(ibuf, 0, szb);
+		szb /= SS(fs);		/* Bytes -> Sectors */
+		for (n = 0; n < fs->csize && disk_write(fs->pdrv, ibuf, sect + n, szb) == RES_OK; n += szb) ;	/* Fill the cluster with 0 */
+		ff_memfree(ibuf);
+	} else
+#endif
+	{
+		ibuf = fs->win; szb = 1;	/* Use window buffer (many single-sector writes may take a time) */
+		for (n = 0; n < fs->csize && disk_write(fs->pdrv, ibuf, sect + n, szb) == RES_OK; n += szb) ;	/* Fill the cluster with 0 */
+	}
+	return (n == fs->csize) ? FR_OK : FR_DISK_ERR;
+}
+#endif	/* !FF_FS_READONLY */
+
+
+
+
+/*-----------------------------------------------------------------------*/
+/* Directory handling - Set directory index                              */
 /*-----------------------------------------------------------------------*/
 
 static FRESULT dir_sdi (	/* FR_OK(0):succeeded, !=0:error */
@@ -1816,31 +2625,104 @@ static FRESULT dir_next (	/* FR_OK(0):succeeded, FR_NO_FILE:End of table, FR_DEN
 
 
 
-#if !FF_FS_READONLY
+#if !FF_FS_READONLY && FF_FS_DIRHINT
 /*-----------------------------------------------------------------------*/
-/* Directory handling - Reserve a block of directory entries             */
+/* Directory handling - Find/Store free entry hint                       */
 /*-----------------------------------------------------------------------*/
 
-static FRESULT dir_alloc (	/* FR_OK(0):succeeded, !=0:error */
-	DIR* dp,				/* Pointer to the directory object */
-	UINT n_ent				/* Number of contiguous entries to allocate */
+static void dhint_seek (
+	DIR* dp					/* Directory object rewinded to top of the directory */
 )
 {
-	FRESULT res;
-	UINT n;
 	FATFS *fs = dp->obj.fs;
+	FFDHINT *hp;
+	UINT i;
 
 
-	res = dir_sdi(dp, 0);
-	if (res == FR_OK) {
-		n = 0;
-		do {
-			res = move_window(fs, dp->sect);
-			if (res != FR_OK) break;
-#if FF_FS_EXFAT
-			if ((fs->fs_type == FS_EXFAT) ? (int)((dp->dir[XDIR_Type] & 0x80) == 0) : (int)(dp->dir[DIR_Name] == DDEM || dp->dir[DIR_Name] == 0)) {	/* Is the entry free? */
+	if (FF_FS_EXFAT && fs->fs_type == FS_EXFAT) return;
+	for (i = 0; i < FF_FS_DIRHINT; i++) {
+		hp = &fs->dhint[i];
+		if (hp->ofs != 0 && hp->dclust == dp->obj.sclust) {	/* Is there the hint of the directory? */
+			dp->dptr = hp->ofs;		/* Go to the entry */
+			dp->clust = hp->clust;
+			if (hp->clust == 0) {	/* Static table */
+				dp->sect = fs->dirbase + hp->ofs / SS(fs);
+			} else {				/* Dynamic table */
+				dp->sect = clst2sect(fs, hp->clust) + hp->ofs / SS(fs) % fs->csize;
+			}
+			dp->dir = fs->win + hp->ofs % SS(fs);
+			return;
+		}
+	}
+}
+
+
+static void dhint_store (
+	FATFS* fs,				/* Filesystem object */
+	DWORD dclust,			/* Directory start cluster (0:root) */
+	DWORD ofs,				/* Offset of the entry, all entries in front of it are in use */
+	DWORD clust,			/* Cluster containing the entry */
+	int rm					/* 0:Entries are allocated, 1:Entries are freed (only moves the hint backward) */
+)
+{
+	FFDHINT *hp;
+	UINT i;
+
+
+	if (FF_FS_EXFAT && fs->fs_type == FS_EXFAT) return;
+	for (i = 0; i < FF_FS_DIRHINT && (fs->dhint[i].ofs == 0 || fs->dhint[i].dclust != dclust); i++) ;	/* Find the item of the directory */
+	if (rm && (i == FF_FS_DIRHINT || fs->dhint[i].ofs <= ofs)) return;	/* Freed entries do not affect the hint? */
+	if (i == FF_FS_DIRHINT) {	/* Not found, replace the oldest item */
+		i = fs->dh_idx;
+		fs->dh_idx = (BYTE)((i + 1) % FF_FS_DIRHINT);
+	}
+	hp = &fs->dhint[i];
+	hp->dclust = dclust;
+	hp->ofs = ofs;
+	hp->clust = clust;
+}
+
+#endif	/* !FF_FS_READONLY && FF_FS_DIRHINT */
+
+
+
+
+#if !FF_FS_READONLY
+/*-----------------------------------------------------------------------*/
+/* Directory handling - Reserve a block of directory entries             */
+/*-----------------------------------------------------------------------*/
+
+static FRESULT dir_alloc (	/* FR_OK(0):succeeded, !=0:error */
+	DIR* dp,				/* Pointer to the directory object */
+	UINT n_ent				/* Number of contiguous entries to allocate */
+)
+{
+	FRESULT res;
+	UINT n;
+	FATFS *fs = dp->obj.fs;
+#if FF_FS_DIRHINT
+	DWORD fofs = 0xFFFFFFFF, fclst = 0;
+#endif
+
+
+	res = dir_sdi(dp, 0);
+	if (res == FR_OK) {
+#if FF_FS_DIRHINT
+		dhint_seek(dp);		/* Skip the entries known to be in use */
+#endif
+		n = 0;
+		do {
+			res = move_window(fs, dp->sect);
+			if (res != FR_OK) break;
+#if FF_FS_EXFAT
+			if ((fs->fs_type == FS_EXFAT) ? (int)((dp->dir[XDIR_Type] & 0x80) == 0) : (int)(dp->dir[DIR_Name] == DDEM || dp->dir[DIR_Name] == 0)) {	/* Is the entry free? */
 #else
 			if (dp->dir[DIR_Name] == DDEM || dp->dir[DIR_Name] == 0) {	/* Is the entry free? */
+#endif
+#if FF_FS_DIRHINT
+				if (fofs == 0xFFFFFFFF) {	/* Record the first free entry */
+					fofs = dp->dptr; fclst = dp->clust;
+				}
 #endif
 				if (++n == n_ent) break;	/* Is a block of contiguous free entries found? */
 			} else {
@@ -1849,6 +2731,14 @@ static FRESULT dir_alloc (	/* FR_OK(0):succeeded, !=0:error */
 			res = dir_next(dp, 1);	/* Next entry with table stretch enabled */
 		} while (res == FR_OK);
 	}
+#if FF_FS_DIRHINT
+	if (res == FR_OK) {
+		if (fofs == dp->dptr - (n_ent - 1) * SZDIRE) {	/* Is the block at the first free entry? */
+			fofs = dp->dptr; fclst = dp->clust;			/* All entries in front of the last entry of the block are in use */
+		}
+		dhint_store(fs, dp->obj.sclust, fofs, fclst, 0);
+	}
+#endif
 
 	if (res == FR_NO_FILE) res = FR_DENIED;	/* No directory entry to allocate */
 	return res;
@@ -2398,6 +3288,229 @@ static FRESULT dir_read (
 
 
 
+#if FF_FS_DIRCACHE
+/*-----------------------------------------------------------------------*/
+/* Directory handling - Directory lookup cache                           */
+/*-----------------------------------------------------------------------*/
+
+static DWORD dcache_hash (	/* Returns hash value of the name to find (0:not to be cached) */
+	DIR* dp					/* Pointer to the directory object with the file name */
+)
+{
+	DWORD hash = 0;
+	UINT i;
+
+
+#if FF_USE_LFN
+	if (dp->fn[NSFLAG] & NS_NOLFN) return 0;	/* Do not cache SFN only search (SFN collision check) */
+	for (i = 0; dp->obj.fs->lfnbuf[i]; i++) {	/* LFN (case insensitive) */
+		hash = hash * 31 + ff_wtoupper(dp->obj.fs->lfnbuf[i]);
+	}
+#else
+	for (i = 0; i < 11; i++) {		/* SFN */
+		hash = hash * 31 + dp->fn[i];
+	}
+#endif
+	return hash ? hash : 1;
+}
+
+
+static DWORD dcache_seek (	/* Returns offset of the SFN entry if cached, 0xFFFFFFFF:not cached */
+	DIR* dp,				/* Directory object rewinded to top of the directory */
+	DWORD hash				/* Hash value of the name to find */
+)
+{
+	FATFS *fs = dp->obj.fs;
+	FFDCACHE *cp;
+	UINT i;
+
+
+	if (hash == 0) return 0xFFFFFFFF;
+	for (i = 0; i < FF_FS_DIRCACHE; i++) {
+		cp = &fs->dcache[i];
+		if (cp->hash == hash && cp->dclust == dp->obj.sclust) {	/* Is the name in the cache? */
+			dp->dptr = cp->ofs;		/* Go to top of the entry block */
+			dp->clust = cp->clust;
+			if (cp->clust == 0) {	/* Static table */
+				dp->sect = fs->dirbase + cp->ofs / SS(fs);
+			} else {				/* Dynamic table */
+				dp->sect = clst2sect(fs, cp->clust) + cp->ofs / SS(fs) % fs->csize;
+			}
+			dp->dir = fs->win + cp->ofs % SS(fs);
+			return cp->dptr;
+		}
+	}
+	return 0xFFFFFFFF;
+}
+
+
+static void dcache_store (
+	DIR* dp,				/* Directory object pointing the found SFN entry */
+	DWORD hash,				/* Hash value of the name */
+	DWORD ofs,				/* Offset of the entry block */
+	DWORD clust				/* Cluster containing top of the entry block */
+)
+{
+	FATFS *fs = dp->obj.fs;
+	FFDCACHE *cp;
+	UINT i;
+
+
+	if (hash == 0) return;
+	for (i = 0; i < FF_FS_DIRCACHE && (fs->dcache[i].hash != hash || fs->dcache[i].dclust != dp->obj.sclust); i++) ;	/* Find the item of the name */
+	if (i == FF_FS_DIRCACHE) {	/* Not found, replace the oldest item */
+		i = fs->dc_idx;
+		fs->dc_idx = (BYTE)((i + 1) % FF_FS_DIRCACHE);
+	}
+	cp = &fs->dcache[i];
+	cp->hash = hash;
+	cp->dclust = dp->obj.sclust;
+	cp->ofs = ofs;
+	cp->clust = clust;
+	cp->dptr = dp->dptr;
+}
+
+#endif	/* FF_FS_DIRCACHE */
+
+
+
+
+#if !FF_FS_READONLY && FF_USE_DIRINDEX
+/*-----------------------------------------------------------------------*/
+/* Directory handling - Hashed directory index                           */
+/*-----------------------------------------------------------------------*/
+/* The index file has a header sector followed by the slots of an open
+/  addressing hash table. A slot holds hash value of the SFN (0:blank,
+/  0xFFFFFFFF:deleted) and offset of the SFN entry in the directory. */
+
+#define DI_SIGNATURE	0x58444944	/* Index header signature "DIDX" */
+#define DI_Sig			0			/* Index header signature (DWORD) */
+#define DI_Clust		4			/* Start cluster of the directory (DWORD) */
+#define DI_NSlot		8			/* Number of slots (DWORD) */
+#define DI_State		12			/* 0:Detached, 1:Attached (BYTE) */
+#define SZ_DISLOT		8			/* Size of a slot */
+
+
+static FFDIDX* didx_get (	/* Returns the index item of the directory (0:not indexed) */
+	FATFS* fs,				/* Filesystem object */
+	DWORD dclust			/* Directory start cluster (0:root) */
+)
+{
+	UINT i;
+
+
+	for (i = 0; i < FF_USE_DIRINDEX; i++) {
+		if (fs->didx[i].sect != 0 && fs->didx[i].dclust == dclust) return &fs->didx[i];
+	}
+	return 0;
+}
+
+
+static DWORD didx_hash (	/* Returns hash value of the SFN (never 0 or 0xFFFFFFFF) */
+	const BYTE* sfn			/* SFN in directory form */
+)
+{
+	DWORD hash = 0;
+	UINT i;
+
+
+	for (i = 0; i < 11; i++) hash = hash * 31 + sfn[i];
+	return (hash == 0 || hash == 0xFFFFFFFF) ? 1 : hash;
+}
+
+
+static BYTE* didx_slot (	/* Returns pointer to the slot in the window (0:disk error) */
+	FATFS* fs,				/* Filesystem object */
+	FFDIDX* ip,				/* Index item */
+	DWORD sn				/* Slot number */
+)
+{
+	UINT spb = SS(fs) / SZ_DISLOT;	/* Slots per sector */
+
+
+	if (move_window(fs, ip->sect + 1 + sn / spb) != FR_OK) return 0;
+	return fs->win + sn % spb * SZ_DISLOT;
+}
+
+
+static FRESULT didx_update (	/* FR_OK:Succeeded, FR_DISK_ERR:A disk error */
+	DIR* dp,				/* Directory object pointing the SFN entry */
+	DWORD hash,				/* Hash value of the SFN */
+	int add					/* 1:The entry has been created, 0:The entry has been removed */
+)
+{
+	FATFS *fs = dp->obj.fs;
+	FFDIDX *ip;
+	DWORD sn, n, h;
+	BYTE *p;
+
+
+	ip = didx_get(fs, dp->obj.sclust);
+	if (!ip) return FR_OK;			/* Not indexed */
+	for (sn = hash % ip->nslot, n = ip->nslot; n; n--, sn = (sn + 1) % ip->nslot) {
+		p = didx_slot(fs, ip, sn);
+		if (!p) return FR_DISK_ERR;
+		h = ld_dword(p);
+		if (add) {
+			if (h == 0 || h == 0xFFFFFFFF) {	/* Put the entry into a blank or deleted slot */
+				st_dword(p, hash); st_dword(p + 4, dp->dptr);
+				fs->wflag = 1;
+				break;
+			}
+		} else {
+			if (h == 0) break;		/* Not in the index */
+			if (h == hash && ld_dword(p + 4) == dp->dptr) {	/* Mark the slot deleted */
+				st_dword(p, 0xFFFFFFFF);
+				fs->wflag = 1;
+				break;
+			}
+		}
+	}
+	if (add && n == 0) ip->sect = 0;	/* The index is full, drop it (it is rebuilt at next attach) */
+	return move_window(fs, dp->sect);	/* Restore the window to the directory entry */
+}
+
+
+static FRESULT didx_find (	/* FR_OK:Found, FR_NO_FILE:Not in the directory, FR_NOT_ENABLED:Not indexed, others:error */
+	DIR* dp					/* Pointer to the directory object with the file name */
+)
+{
+	FRESULT res;
+	FATFS *fs = dp->obj.fs;
+	FFDIDX *ip;
+	DWORD hash, sn, n;
+	BYTE *p;
+
+
+	ip = didx_get(fs, dp->obj.sclust);
+	if (!ip) return FR_NOT_ENABLED;
+	hash = didx_hash(dp->fn);
+	for (sn = hash % ip->nslot, n = ip->nslot; n; n--, sn = (sn + 1) % ip->nslot) {
+		p = didx_slot(fs, ip, sn);
+		if (!p) return FR_DISK_ERR;
+		if (ld_dword(p) == 0) break;	/* A blank slot terminates the probe */
+		if (ld_dword(p) == hash) {		/* Check the entry pointed by the slot */
+			res = dir_sdi(dp, ld_dword(p + 4));
+			if (res == FR_OK) res = move_window(fs, dp->sect);
+			if (res == FR_INT_ERR) {	/* Broken index? */
+				ip->sect = 0;
+				return FR_NOT_ENABLED;
+			}
+			if (res != FR_OK) return res;
+			if (dp->dir[DIR_Name] != DDEM && IsSameSFN(dp->dir, dp->fn) && !(dp->dir[DIR_Attr] & AM_VOL)) {
+				dp->obj.attr = dp->dir[DIR_Attr] & AM_MASK;
+				return FR_OK;
+			}
+		}
+	}
+	return FR_NO_FILE;
+}
+
+#endif	/* !FF_FS_READONLY && FF_USE_DIRINDEX */
+
+
+
+
 /*-----------------------------------------------------------------------*/
 /* Directory handling - Find an object in the directory                  */
 /*-----------------------------------------------------------------------*/
@@ -2411,6 +3524,12 @@ static FRESULT dir_find (	/* FR_OK(0):succeeded, !=0:error */
 	BYTE c;
 #if FF_USE_LFN
 	BYTE a, ord, sum;
+#endif
+#if FF_FS_DIRCACHE
+	DWORD hash, lim;
+#if FF_USE_LFN
+	DWORD bclust = 0;
+#endif
 #endif
 
 	res = dir_sdi(dp, 0);			/* Rewind directory object */
@@ -2436,6 +3555,17 @@ static FRESULT dir_find (	/* FR_OK(0):succeeded, !=0:error */
 	}
 #endif
 	/* On the FAT/FAT32 volume */
+#if !FF_FS_READONLY && FF_USE_DIRINDEX
+	res = didx_find(dp);			/* Look up the name in the directory index */
+	if (res != FR_NOT_ENABLED) return res;
+	res = dir_sdi(dp, 0);			/* Not indexed, search from top of the directory */
+	if (res != FR_OK) return res;
+#endif
+#if FF_FS_DIRCACHE
+	hash = dcache_hash(dp);
+	lim = dcache_seek(dp, hash);	/* Go to the entry block if the name is in the cache */
+	for (;;) {
+#endif
 #if FF_USE_LFN
 	ord = sum = 0xFF; dp->blk_ofs = 0xFFFFFFFF;	/* Reset LFN sequence */
 #endif
@@ -2455,6 +3585,9 @@ static FRESULT dir_find (	/* FR_OK(0):succeeded, !=0:error */
 						c &= (BYTE)~LLEF;
 						ord = c;					/* Number of LFN entries */
 						dp->blk_ofs = dp->dptr;		/* Start offset of LFN */
+#if FF_FS_DIRCACHE
+						bclust = dp->clust;			/* Cluster containing the start of LFN */
+#endif
 						sum = dp->dir[LDIR_Chksum];	/* Sum of the SFN */
 					}
 					/* Check validity of the LFN entry and compare it with given name */
@@ -2462,16 +3595,38 @@ static FRESULT dir_find (	/* FR_OK(0):succeeded, !=0:error */
 				}
 			} else {					/* SFN entry */
 				if (ord == 0 && sum == sum_sfn(dp->dir)) break;	/* LFN matched? */
-				if (!(dp->fn[NSFLAG] & NS_LOSS) && !memcmp(dp->dir, dp->fn, 11)) break;	/* SFN matched? */
+				if (!(dp->fn[NSFLAG] & NS_LOSS) && IsSameSFN(dp->dir, dp->fn)) break;	/* SFN matched? */
 				ord = 0xFF; dp->blk_ofs = 0xFFFFFFFF;	/* Not matched, reset LFN sequence */
 			}
 		}
 #else		/* Non LFN configuration */
-		dp->obj.attr = dp->dir[DIR_Attr] & AM_MASK;
-		if (!(dp->dir[DIR_Attr] & AM_VOL) && !memcmp(dp->dir, dp->fn, 11)) break;	/* Is it a valid entry? */
+		if (IsSameSFN(dp->dir, dp->fn) && !(dp->dir[DIR_Attr] & AM_VOL)) {	/* Is it a valid entry? */
+			dp->obj.attr = dp->dir[DIR_Attr] & AM_MASK;
+			break;
+		}
 #endif
 		res = dir_next(dp, 0);	/* Next entry */
+#if FF_FS_DIRCACHE
+		if (res == FR_OK && dp->dptr > lim) res = FR_NO_FILE;	/* Passed the cached entry block */
+#endif
 	} while (res == FR_OK);
+#if FF_FS_DIRCACHE
+		if (res != FR_NO_FILE || lim == 0xFFFFFFFF) break;
+		lim = 0xFFFFFFFF;			/* The cached entry did not match, search from top of the directory */
+		res = dir_sdi(dp, 0);
+		if (res != FR_OK) return res;
+	}
+	if (res == FR_OK) {				/* Store the location of the found entry */
+#if FF_USE_LFN
+		if (dp->blk_ofs != 0xFFFFFFFF) {
+			dcache_store(dp, hash, dp->blk_ofs, bclust);
+		} else
+#endif
+		{
+			dcache_store(dp, hash, dp->dptr, dp->clust);
+		}
+	}
+#endif
 
 	return res;
 }
@@ -2494,7 +3649,6 @@ static FRESULT dir_register (	/* FR_OK:succeeded, FR_DENIED:no free entry or too
 	UINT n, len, n_ent;
 	BYTE sn[12], sum;
 
-
 	if (dp->fn[NSFLAG] & (NS_DOT | NS_NONAME)) return FR_INVALID_NAME;	/* Check name validity */
 	for (len = 0; fs->lfnbuf[len]; len++) ;	/* Get lfn length */
 
@@ -2563,6 +3717,9 @@ static FRESULT dir_register (	/* FR_OK:succeeded, FR_DENIED:no free entry or too
 #else	/* Non LFN configuration */
 	res = dir_alloc(dp, 1);		/* Allocate an entry for SFN */
 
+#endif
+#if FF_FS_DIRCACHE
+	memset(fs->dcache, 0, sizeof fs->dcache);	/* Flush directory lookup cache */
 #endif
 
 	/* Set SFN entry */
@@ -2575,6 +3732,9 @@ static FRESULT dir_register (	/* FR_OK:succeeded, FR_DENIED:no free entry or too
 			dp->dir[DIR_NTres] = dp->fn[NSFLAG] & (NS_BODY | NS_EXT);	/* Put NT flag */
 #endif
 			fs->wflag = 1;
+#if FF_USE_DIRINDEX
+			res = didx_update(dp, didx_hash(dp->fn), 1);	/* Add the entry to the directory index */
+#endif
 		}
 	}
 
@@ -2598,9 +3758,20 @@ static FRESULT dir_remove (	/* FR_OK:Succeeded, FR_DISK_ERR:A disk error */
 	FATFS *fs = dp->obj.fs;
 #if FF_USE_LFN		/* LFN configuration */
 	DWORD last = dp->dptr;
+#endif
+#if FF_USE_DIRINDEX
+	DWORD hash;
+#endif
 
+#if FF_FS_DIRCACHE
+	memset(fs->dcache, 0, sizeof fs->dcache);	/* Flush directory lookup cache */
+#endif
+#if FF_USE_LFN		/* LFN configuration */
 	res = (dp->blk_ofs == 0xFFFFFFFF) ? FR_OK : dir_sdi(dp, dp->blk_ofs);	/* Goto top of the entry block if LFN is exist */
 	if (res == FR_OK) {
+#if FF_FS_DIRHINT
+		dhint_store(fs, dp->obj.sclust, dp->dptr, dp->clust, 1);	/* The entry block is going to be free */
+#endif
 		do {
 			res = move_window(fs, dp->sect);
 			if (res != FR_OK) break;
@@ -2619,8 +3790,17 @@ static FRESULT dir_remove (	/* FR_OK:Succeeded, FR_DISK_ERR:A disk error */
 
 	res = move_window(fs, dp->sect);
 	if (res == FR_OK) {
+#if FF_USE_DIRINDEX
+		hash = didx_hash(dp->dir);
+#endif
 		dp->dir[DIR_Name] = DDEM;	/* Mark the entry 'deleted'.*/
 		fs->wflag = 1;
+#if FF_FS_DIRHINT
+		dhint_store(fs, dp->obj.sclust, dp->dptr, dp->clust, 1);	/* The entry is free */
+#endif
+#if FF_USE_DIRINDEX
+		res = didx_update(dp, hash, 0);	/* Remove the entry from the directory index */
+#endif
 	}
 #endif
 
@@ -2631,6 +3811,113 @@ static FRESULT dir_remove (	/* FR_OK:Succeeded, FR_DISK_ERR:A disk error */
 
 
 
+#if !FF_FS_READONLY
+/*-----------------------------------------------------------------------*/
+/* FAT: Directory handling - Update directory entry of the modified file */
+/*-----------------------------------------------------------------------*/
+
+static void sync_fdirent (
+	FIL* fp,		/* Pointer to the file object (its directory entry is in the window) */
+	DWORD tm		/* Modified time */
+)
+{
+	FATFS *fs = fp->obj.fs;
+	BYTE *dir = fp->dir_ptr;
+
+
+#if FF_FS_SYNCBATCH
+	if (!(dir[DIR_Attr] & AM_ARC) || ld_clust(fs, dir) != fp->obj.sclust || ld_dword(dir + DIR_FileSize) != (DWORD)fp->obj.objsize
+		|| ld_dword(dir + DIR_ModTime) != tm || ld_word(dir + DIR_LstAccDate) != 0)	/* Skip if the entry is current */
+#endif
+	{
+		dir[DIR_Attr] |= AM_ARC;						/* Set archive attribute to indicate that the file has been changed */
+		st_clust(fs, dir, fp->obj.sclust);				/* Update file allocation information  */
+		st_dword(dir + DIR_FileSize, (DWORD)fp->obj.objsize);	/* Update file size */
+		st_dword(dir + DIR_ModTime, tm);				/* Update modified time */
+		st_word(dir + DIR_LstAccDate, 0);
+		fs->wflag = 1;
+	}
+	fp->flag &= (BYTE)~FA_MODIFIED;
+}
+
+
+
+
+/*-----------------------------------------------------------------------*/
+/* Directory handling - Flush cached data and update the directory entry */
+/*-----------------------------------------------------------------------*/
+
+static FRESULT sync_fobj (	/* FR_OK(0):succeeded, !=0:error (the filesystem is not flushed) */
+	FIL* fp,		/* Pointer to the modified file object */
+	DWORD tm		/* Modified time */
+)
+{
+	FRESULT res;
+	FATFS *fs = fp->obj.fs;
+#if FF_FS_SYNCBATCH
+	FIL *fp2;
+#endif
+
+
+#if !FF_FS_TINY
+	if (fp->flag & FA_DIRTY) {	/* Write-back cached data if needed */
+		if (disk_write(fs->pdrv, fp->buf, fp->sect, 1) != RES_OK) return FR_DISK_ERR;
+		fp->flag &= (BYTE)~FA_DIRTY;
+	}
+#endif
+#if FF_FS_EXFAT
+	if (fs->fs_type == FS_EXFAT) {
+		res = fill_first_frag(&fp->obj);	/* Fill first fragment on the FAT if needed */
+		if (res == FR_OK) {
+			res = fill_last_frag(&fp->obj, fp->clust, 0xFFFFFFFF);	/* Fill last fragment on the FAT if needed */
+		}
+		if (res == FR_OK) {
+			DIR dj;
+			DEF_NAMBUF
+
+			INIT_NAMBUF(fs);
+			res = load_obj_xdir(&dj, &fp->obj);	/* Load directory entry block */
+			if (res == FR_OK) {
+				fs->dirbuf[XDIR_Attr] |= AM_ARC;				/* Set archive attribute to indicate that the file has been changed */
+				fs->dirbuf[XDIR_GenFlags] = fp->obj.stat | 1;	/* Update file allocation information */
+				st_dword(fs->dirbuf + XDIR_FstClus, fp->obj.sclust);		/* Update start cluster */
+				st_qword(fs->dirbuf + XDIR_FileSize, fp->obj.objsize);		/* Update file size */
+				st_qword(fs->dirbuf + XDIR_ValidFileSize, fp->obj.objsize);	/* (FatFs does not support Valid File Size feature) */
+				st_dword(fs->dirbuf + XDIR_ModTime, tm);		/* Update modified time */
+				fs->dirbuf[XDIR_ModTime10] = 0;
+				st_dword(fs->dirbuf + XDIR_AccTime, 0);
+				res = store_xdir(&dj);	/* Restore it to the directory */
+				if (res == FR_OK) fp->flag &= (BYTE)~FA_MODIFIED;
+			}
+			FREE_NAMBUF();
+		}
+	} else
+#endif
+	{
+		res = move_window(fs, fp->dir_sect);
+#if FF_FS_SYNCBATCH
+		for (fp2 = fs->flist; res == FR_OK && fp2; fp2 = fp2->fnext) {	/* Update all modified files in this directory sector */
+			if (fp2 != fp && fp2->obj.fs == fs && fp2->obj.id == fs->id && fp2->err == 0 && (fp2->flag & FA_MODIFIED) && fp2->dir_sect == fp->dir_sect) {
+#if !FF_FS_TINY
+				if (fp2->flag & FA_DIRTY) {	/* Write-back cached data of the file */
+					if (disk_write(fs->pdrv, fp2->buf, fp2->sect, 1) != RES_OK) return FR_DISK_ERR;
+					fp2->flag &= (BYTE)~FA_DIRTY;
+				}
+#endif
+				sync_fdirent(fp2, tm);
+			}
+		}
+#endif
+		if (res == FR_OK) sync_fdirent(fp, tm);	/* Update the directory entry */
+	}
+
+	return res;
+}
+
+#endif /* !FF_FS_READONLY */
+
+
+
 #if FF_FS_MINIMIZE <= 1 || FF_FS_RPATH >= 2
 /*-----------------------------------------------------------------------*/
 /* Get file information from directory entry                             */
@@ -3394,14 +4681,92 @@ static UINT find_volume (	/* Returns BS status found in the hosting drive */
 
 
 
+#if FF_FS_SOFTMOUNT
 /*-----------------------------------------------------------------------*/
-/* Determine logical drive number and mount the volume if needed         */
+/* Soft unmount - Get checksum of the media ID and VBR                   */
 /*-----------------------------------------------------------------------*/
 
-static FRESULT mount_volume (	/* FR_OK(0): successful, !=0: an error occurred */
-	const TCHAR** path,			/* Pointer to pointer to the path name (drive number) */
-	FATFS** rfs,				/* Pointer to pointer to the found filesystem object */
-	BYTE mode					/* Desiered access mode to check write protection */
+static DWORD sum_volume (	/* Returns checksum of the media ID and the VBR */
+	FATFS* fs				/* Filesystem object with the VBR in the win[] */
+)
+{
+	BYTE id[16];
+	DWORD sum = 0;
+	UINT i;
+
+
+	if (disk_ioctl(fs->pdrv, GET_MEDIA_ID, id) == RES_OK) {	/* Media ID is available? */
+		for (i = 0; i < 16; i++) {
+			sum = ((sum & 1) ? 0x80000000 : 0) + (sum >> 1) + id[i];
+		}
+	}
+	for (i = 0; i < SS(fs); i++) {
+		sum = ((sum & 1) ? 0x80000000 : 0) + (sum >> 1) + fs->win[i];
+	}
+	return sum;
+}
+
+
+
+
+/*-----------------------------------------------------------------------*/
+/* Soft unmount - Resume the volume state kept in the filesystem object  */
+/*-----------------------------------------------------------------------*/
+
+static FRESULT resume_volume (	/* FR_OK:Resumed, FR_NO_FILESYSTEM:Not resumed, needs to be mounted, !=0:An error occurred */
+	FATFS* fs,					/* Filesystem object to be resumed */
+	BYTE mode					/* Desiered access mode to check write protection */
+)
+{
+	DSTATUS stat;
+	BYTE fmt;
+
+
+	fmt = fs->sm_type;
+	fs->sm_type = 0;					/* The kept state can be used only once */
+	if (fmt == 0) return FR_NO_FILESYSTEM;	/* No volume state is kept */
+	stat = disk_status(fs->pdrv);
+	if (stat & STA_NOINIT) return FR_NO_FILESYSTEM;	/* The drive has been reset after soft unmount */
+	if (!FF_FS_READONLY && mode && (stat & STA_PROTECT)) {	/* Check disk write protection if needed */
+		return FR_WRITE_PROTECTED;
+	}
+	fs->wflag = 0; fs->winsect = (LBA_t)0 - 1;	/* Invalidate window */
+	if (move_window(fs, fs->volbase) != FR_OK || sum_volume(fs) != fs->sm_sum) {	/* Is it the same volume? */
+		return FR_NO_FILESYSTEM;
+	}
+
+	fs->fs_type = fmt;		/* FAT sub-type (the filesystem object gets valid again) */
+	fs->id = ++Fsid;		/* Volume mount ID (objects opened before unmount are not resumed) */
+#if FF_FS_SYNCBATCH
+	fs->flist = 0;			/* No writable file is opened */
+#endif
+#if FF_USE_LFN == 1
+	fs->lfnbuf = LfnBuf;	/* Static LFN working buffer */
+#if FF_FS_EXFAT
+	fs->dirbuf = DirBuf;	/* Static directory block scratchpad buuffer */
+#endif
+#endif
+#if FF_FS_RPATH != 0
+	fs->cdir = 0;			/* Initialize current directory */
+#endif
+#if FF_FS_LOCK				/* Clear file lock semaphores */
+	clear_share(fs);
+#endif
+	return FR_OK;
+}
+#endif	/* FF_FS_SOFTMOUNT */
+
+
+
+
+/*-----------------------------------------------------------------------*/
+/* Determine logical drive number and mount the volume if needed         */
+/*-----------------------------------------------------------------------*/
+
+static FRESULT mount_volume (	/* FR_OK(0): successful, !=0: an error occurred */
+	const TCHAR** path,			/* Pointer to pointer to the path name (drive number) */
+	FATFS** rfs,				/* Pointer to pointer to the found filesystem object */
+	BYTE mode					/* Desiered access mode to check write protection */
 )
 {
 	int vol;
@@ -3411,6 +4776,9 @@ static FRESULT mount_volume (	/* FR_OK(0): successful, !=0: an error occurred */
 	DWORD tsect, sysect, fasize, nclst, szbfat;
 	WORD nrsv;
 	UINT fmt;
+#if FF_FS_SOFTMOUNT
+	FRESULT res;
+#endif
 
 
 	/* Get logical drive number */
@@ -3441,6 +4809,10 @@ static FRESULT mount_volume (	/* FR_OK(0): successful, !=0: an error occurred */
 	/* Following code attempts to mount the volume. (find an FAT volume, analyze the BPB and initialize the filesystem object) */
 
 	fs->fs_type = 0;					/* Invalidate the filesystem object */
+#if FF_FS_SOFTMOUNT
+	res = resume_volume(fs, mode);		/* Try to resume the volume state kept by soft unmount */
+	if (res != FR_NO_FILESYSTEM) return res;
+#endif
 	stat = disk_initialize(fs->pdrv);	/* Initialize the volume hosting physical drive */
 	if (stat & STA_NOINIT) { 			/* Check if the initialization succeeded */
 		return FR_NOT_READY;			/* Failed to initialize due to no medium or hard error */
@@ -3458,6 +4830,9 @@ static FRESULT mount_volume (	/* FR_OK(0): successful, !=0: an error occurred */
 	if (fmt == 4) return FR_DISK_ERR;		/* An error occurred in the disk I/O layer */
 	if (fmt >= 2) return FR_NO_FILESYSTEM;	/* No FAT volume is found */
 	bsect = fs->winsect;					/* Volume offset in the hosting physical drive */
+#if FF_FS_SOFTMOUNT
+	fs->sm_sum = sum_volume(fs);			/* Checksum to identify the volume at resume */
+#endif
 
 	/* An FAT volume is found (bsect). Following code initializes the filesystem object */
 
@@ -3581,6 +4956,11 @@ static FRESULT mount_volume (	/* FR_OK(0): successful, !=0: an error occurred */
 		/* Get FSInfo if available */
 		fs->last_clst = fs->free_clst = 0xFFFFFFFF;		/* Invalidate cluster allocation information */
 		fs->fsi_flag = 0x80;	/* Disable FSInfo by default */
+#if FF_FS_LAZYFREE
+		if (fmt == FS_FAT32 && ld_word(fs->win + BPB_FSInfo32) == 1) {
+			fs->fsi_flag = 0x40;	/* FAT32: FSInfo is loaded on demand */
+		}
+#else
 		if (fmt == FS_FAT32
 			&& ld_word(fs->win + BPB_FSInfo32) == 1	/* FAT32: Enable FSInfo feature only if FSInfo sector is next to VBR */
 			&& move_window(fs, bsect + 1) == FR_OK)
@@ -3598,11 +4978,33 @@ static FRESULT mount_volume (	/* FR_OK(0): successful, !=0: an error occurred */
 #endif
 			}
 		}
+#endif
 #endif	/* !FF_FS_READONLY */
 	}
 
 	fs->fs_type = (BYTE)fmt;/* FAT sub-type (the filesystem object gets valid) */
 	fs->id = ++Fsid;		/* Volume mount ID */
+#if FF_FS_SYNCBATCH
+	fs->flist = 0;			/* No writable file is opened */
+#endif
+#if !FF_FS_READONLY && FF_FS_EOCHINT
+	memset(fs->eoch, 0, sizeof fs->eoch);	/* Clear end-of-chain hint table */
+	fs->eoch_idx = 0;
+#endif
+#if FF_FS_DIRCACHE
+	memset(fs->dcache, 0, sizeof fs->dcache);	/* Clear directory lookup cache */
+	fs->dc_idx = 0;
+#endif
+#if !FF_FS_READONLY && FF_FS_DIRHINT
+	memset(fs->dhint, 0, sizeof fs->dhint);	/* Clear free entry hint table */
+	fs->dh_idx = 0;
+#endif
+#if !FF_FS_READONLY && FF_USE_DIRINDEX
+	memset(fs->didx, 0, sizeof fs->didx);	/* No directory is indexed */
+#endif
+#if !FF_FS_READONLY && FF_FS_LAZYFREE
+	fs->fr_clst = 2; fs->fr_cnt = 0;	/* Free clusters are to be counted */
+#endif
 #if FF_USE_LFN == 1
 	fs->lfnbuf = LfnBuf;	/* Static LFN working buffer */
 #if FF_FS_EXFAT
@@ -3672,7 +5074,7 @@ static FRESULT validate (	/* Returns FR_OK or FR_INVALID_OBJECT */
 FRESULT f_mount (
 	FATFS* fs,			/* Pointer to the filesystem object to be registered (NULL:unmount)*/
 	const TCHAR* path,	/* Logical drive number to be mounted/unmounted */
-	BYTE opt			/* Mount option: 0=Do not mount (delayed mount), 1=Mount immediately */
+	BYTE opt			/* Mount option: 0=Do not mount (delayed mount), 1=Mount immediately; Unmount option: 0=Unmount, 1=Soft unmount */
 )
 {
 	FATFS *cfs;
@@ -3693,6 +5095,21 @@ FRESULT f_mount (
 #endif
 #if FF_FS_REENTRANT				/* Discard mutex of the current volume */
 		ff_mutex_delete(vol);
+#endif
+#if FF_FS_SOFTMOUNT
+		SoftFs[vol] = 0;
+		if (!fs && opt == 1 && cfs->fs_type != 0 && !(disk_status(cfs->pdrv) & STA_NOINIT)) {	/* Soft unmount? */
+#if !FF_FS_READONLY
+			if (sync_fs(cfs) == FR_OK)	/* Flush the cached data */
+#endif
+			{
+				cfs->sm_type = cfs->fs_type;	/* Keep the volume state for next registration */
+				SoftFs[vol] = cfs;
+			}
+		}
+#endif
+#if FF_FS_BUFPOOL
+		bpool_release(0, cfs);	/* Release sector buffers of the files on the volume */
 #endif
 		cfs->fs_type = 0;		/* Invalidate the filesystem object to be unregistered */
 	}
@@ -3713,10 +5130,14 @@ FRESULT f_mount (
 #endif
 #endif
 		fs->fs_type = 0;		/* Invalidate the new filesystem object */
+#if FF_FS_SOFTMOUNT
+		if (fs != SoftFs[vol]) fs->sm_type = 0;	/* Volume state can be resumed only on the object unmounted softly */
+		SoftFs[vol] = 0;
+#endif
 		FatFs[vol] = fs;		/* Register new fs object */
 	}
 
-	if (opt == 0) return FR_OK;	/* Do not mount now, it will be mounted in subsequent file functions */
+	if (!fs || opt == 0) return FR_OK;	/* Unmounted, or do not mount now, it will be mounted in subsequent file functions */
 
 	res = mount_volume(&path, &fs, 0);	/* Force mounted the volume */
 	LEAVE_FF(fs, res);
@@ -3742,11 +5163,17 @@ FRESULT f_open (
 	DWORD cl, bcs, clst, tm;
 	LBA_t sc;
 	FSIZE_t ofs;
+#endif
+#if FF_FS_SYNCBATCH
+	FIL *fp2;
 #endif
 	DEF_NAMBUF
 
 
 	if (!fp) return FR_INVALID_OBJECT;
+#if FF_FS_BUFPOOL
+	bpool_release(fp, 0);	/* Discard the sector buffer left in the blank file object */
+#endif
 
 	/* Get logical drive number */
 	mode &= FF_FS_READONLY ? FA_READ : FA_READ | FA_WRITE | FA_CREATE_ALWAYS | FA_CREATE_NEW | FA_OPEN_ALWAYS | FA_OPEN_APPEND;
@@ -3872,6 +5299,13 @@ FRESULT f_open (
 			}
 #if FF_USE_FASTSEEK
 			fp->cltbl = 0;		/* Disable fast seek mode */
+#endif
+#if FF_USE_PREALLOC
+			fp->pa_ncl = 0; fp->pa_len = 0;	/* Not in streaming mode */
+#endif
+#if FF_FS_AUTOMAP
+			fp->am_stat = fp->obj.sclust ? 0 : 1;	/* Cluster map is not built yet (or empty if no cluster) */
+			fp->am_cnt = 0; fp->am_ncl = 0;
 #endif
 			fp->obj.fs = fs;	/* Validate the file object */
 			fp->obj.id = fs->id;
@@ -3880,26 +5314,48 @@ FRESULT f_open (
 			fp->sect = 0;		/* Invalidate current data sector */
 			fp->fptr = 0;		/* Set file pointer top of the file */
 #if !FF_FS_READONLY
-#if !FF_FS_TINY
+#if !FF_FS_TINY && !FF_FS_BUFPOOL
 			memset(fp->buf, 0, sizeof fp->buf);	/* Clear sector buffer */
 #endif
 			if ((mode & FA_SEEKEND) && fp->obj.objsize > 0) {	/* Seek to end of file if FA_OPEN_APPEND is specified */
 				fp->fptr = fp->obj.objsize;			/* Offset to seek */
 				bcs = (DWORD)fs->csize * SS(fs);	/* Cluster size in byte */
 				clst = fp->obj.sclust;				/* Follow the cluster chain */
-				for (ofs = fp->obj.objsize; res == FR_OK && ofs > bcs; ofs -= bcs) {
+				ofs = fp->obj.objsize;
+#if FF_FS_EOCHINT
+				cl = (!FF_FS_EXFAT || fs->fs_type != FS_EXFAT) ? eoch_find(fs, fp->dir_sect, (UINT)(fp->dir_ptr - fs->win), clst, ofs) : 0;
+				if (cl != 0) {						/* Is the last cluster known? */
+					clst = cl;						/* Skip the chain walk */
+					ofs = (ofs - 1) % bcs + 1;
+				}
+#endif
+#if FF_FS_AUTOMAP
+				if (clst == fp->obj.sclust) {		/* Build the cluster map while following the chain */
+					fp->am_stat = 1;
+					amap_add(fp, 0, clst);
+				}
+#endif
+				for ( ; res == FR_OK && ofs > bcs; ofs -= bcs) {
 					clst = get_fat(&fp->obj, clst);
 					if (clst <= 1) res = FR_INT_ERR;
 					if (clst == 0xFFFFFFFF) res = FR_DISK_ERR;
+#if FF_FS_AUTOMAP
+					if (res == FR_OK) amap_add(fp, fp->am_ncl, clst);
+#endif
 				}
 				fp->clust = clst;
+#if FF_FS_EOCHINT
+				if (res == FR_OK && (!FF_FS_EXFAT || fs->fs_type != FS_EXFAT)) {	/* Save the last cluster for next append open */
+					eoch_store(fs, fp->dir_sect, (UINT)(fp->dir_ptr - fs->win), fp->obj.sclust, fp->obj.objsize, clst);
+				}
+#endif
 				if (res == FR_OK && ofs % SS(fs)) {	/* Fill sector buffer if not on the sector boundary */
 					sc = clst2sect(fs, clst);
 					if (sc == 0) {
 						res = FR_INT_ERR;
 					} else {
 						fp->sect = sc + (DWORD)(ofs / SS(fs));
-#if !FF_FS_TINY
+#if !FF_FS_TINY && !FF_FS_BUFPOOL	/* (Pooled buffer will be filled on the first access) */
 						if (disk_read(fs->pdrv, fp->buf, fp->sect, 1) != RES_OK) res = FR_DISK_ERR;
 #endif
 					}
@@ -3915,6 +5371,15 @@ FRESULT f_open (
 	}
 
 	if (res != FR_OK) fp->obj.fs = 0;	/* Invalidate file object on error */
+#if FF_FS_SYNCBATCH
+	if (res == FR_OK && (fp->flag & FA_WRITE)) {	/* Add the file to the list of writable files */
+		for (fp2 = fs->flist; fp2 && fp2 != fp; fp2 = fp2->fnext) ;
+		if (!fp2) {
+			fp->fnext = fs->flist;
+			fs->flist = fp;
+		}
+	}
+#endif
 
 	LEAVE_FF(fs, res);
 }
@@ -3946,6 +5411,10 @@ FRESULT f_read (
 	res = validate(&fp->obj, &fs);				/* Check validity of the file object */
 	if (res != FR_OK || (res = (FRESULT)fp->err) != FR_OK) LEAVE_FF(fs, res);	/* Check validity */
 	if (!(fp->flag & FA_READ)) LEAVE_FF(fs, FR_DENIED); /* Check access mode */
+#if FF_FS_BUFPOOL
+	res = bpool_attach(fp, 1);				/* Get sector buffer from the pool */
+	if (res != FR_OK) LEAVE_FF(fs, res);
+#endif
 	remain = fp->obj.objsize - fp->fptr;
 	if (btr > remain) btr = (UINT)remain;		/* Truncate btr by remaining bytes */
 
@@ -3962,6 +5431,10 @@ FRESULT f_read (
 					} else
 #endif
 					{
+#if FF_FS_AUTOMAP
+						clst = amap_clust(fp, (DWORD)(fp->fptr / SS(fs) / fs->csize));	/* Get cluster# from the cluster map */
+						if (clst == 0)
+#endif
 						clst = get_fat(&fp->obj, fp->clust);	/* Follow cluster chain on the FAT */
 					}
 				}
@@ -3975,9 +5448,16 @@ FRESULT f_read (
 			cc = btr / SS(fs);					/* When remaining bytes >= sector size, */
 			if (cc > 0) {						/* Read maximum contiguous sectors directly */
 				if (csect + cc > fs->csize) {	/* Clip at cluster boundary */
+#if FF_FS_EXTENT
+					cc = ext_run(fp, csect, cc, 0);	/* or end of the contiguous clusters */
+#else
 					cc = fs->csize - csect;
+#endif
 				}
 				if (disk_read(fs->pdrv, rbuff, sect, cc) != RES_OK) ABORT(fs, FR_DISK_ERR);
+#if FF_FS_EXTENT == 2
+				ff_extent_stat(fs->pdrv, cc, 0);
+#endif
 #if !FF_FS_READONLY && FF_FS_MINIMIZE <= 2		/* Replace one of the read sectors with cached data if it contains a dirty sector */
 #if FF_FS_TINY
 				if (fs->wflag && fs->winsect - sect < cc) {
@@ -4000,7 +5480,12 @@ FRESULT f_read (
 					fp->flag &= (BYTE)~FA_DIRTY;
 				}
 #endif
+#if FF_FS_READAHEAD
+				res = rahead_load(fp, sect, csect);	/* Fill sector cache with read-ahead */
+				if (res != FR_OK) ABORT(fs, res);
+#else
 				if (disk_read(fs->pdrv, fp->buf, sect, 1) != RES_OK) ABORT(fs, FR_DISK_ERR);	/* Fill sector cache */
+#endif
 			}
 #endif
 			fp->sect = sect;
@@ -4039,12 +5524,22 @@ FRESULT f_write (
 	LBA_t sect;
 	UINT wcnt, cc, csect;
 	const BYTE *wbuff = (const BYTE*)buff;
+#if FF_USE_PREALLOC
+	DWORD ncl;
+#endif
 
 
 	*bw = 0;	/* Clear write byte counter */
 	res = validate(&fp->obj, &fs);			/* Check validity of the file object */
 	if (res != FR_OK || (res = (FRESULT)fp->err) != FR_OK) LEAVE_FF(fs, res);	/* Check validity */
 	if (!(fp->flag & FA_WRITE)) LEAVE_FF(fs, FR_DENIED);	/* Check access mode */
+#if FF_FS_BUFPOOL
+	res = bpool_attach(fp, 1);				/* Get sector buffer from the pool */
+	if (res != FR_OK) LEAVE_FF(fs, res);
+#endif
+#if FF_FS_READAHEAD
+	rahead_discard(fp);						/* Read-ahead data of the file is going to be stale */
+#endif
 
 	/* Check fptr wrap-around (file size cannot reach 4 GiB at FAT volume) */
 	if ((!FF_FS_EXFAT || fs->fs_type != FS_EXFAT) && (DWORD)(fp->fptr + btw) < (DWORD)fp->fptr) {
@@ -4055,26 +5550,14 @@ FRESULT f_write (
 		if (fp->fptr % SS(fs) == 0) {		/* On the sector boundary? */
 			csect = (UINT)(fp->fptr / SS(fs)) & (fs->csize - 1);	/* Sector offset in the cluster */
 			if (csect == 0) {				/* On the cluster boundary? */
-				if (fp->fptr == 0) {		/* On the top of the file? */
-					clst = fp->obj.sclust;	/* Follow from the origin */
-					if (clst == 0) {		/* If no cluster is allocated, */
-						clst = create_chain(&fp->obj, 0);	/* create a new cluster chain */
-					}
-				} else {					/* On the middle or end of the file */
-#if FF_USE_FASTSEEK
-					if (fp->cltbl) {
-						clst = clmt_clust(fp, fp->fptr);	/* Get cluster# from the CLMT */
-					} else
-#endif
-					{
-						clst = create_chain(&fp->obj, fp->clust);	/* Follow or stretch cluster chain on the FAT */
-					}
-				}
+				clst = wr_clust(fp);		/* Follow or stretch cluster chain */
 				if (clst == 0) break;		/* Could not allocate a new cluster (disk full) */
 				if (clst == 1) ABORT(fs, FR_INT_ERR);
 				if (clst == 0xFFFFFFFF) ABORT(fs, FR_DISK_ERR);
 				fp->clust = clst;			/* Update current cluster */
-				if (fp->obj.sclust == 0) fp->obj.sclust = clst;	/* Set start cluster if the first write */
+#if FF_FS_AUTOMAP
+				amap_add(fp, (DWORD)(fp->fptr / SS(fs) / fs->csize), clst);	/* Add the cluster to the map if the chain is stretched */
+#endif
 			}
 #if FF_FS_TINY
 			if (fs->winsect == fp->sect && sync_window(fs) != FR_OK) ABORT(fs, FR_DISK_ERR);	/* Write-back sector cache */
@@ -4089,10 +5572,33 @@ FRESULT f_write (
 			sect += csect;
 			cc = btw / SS(fs);				/* When remaining bytes >= sector size, */
 			if (cc > 0) {					/* Write maximum contiguous sectors directly */
+#if FF_USE_PREALLOC
+				ncl = fp->clust - fp->pa_top;	/* Cluster offset in the preallocated region */
+				if (fp->pa_ncl != 0 && ncl < fp->pa_len) {	/* Clip at end of the preallocated region */
+					if (cc > (fp->pa_len - ncl) * fs->csize - csect) {
+						cc = (UINT)((fp->pa_len - ncl) * fs->csize - csect);
+					}
+				} else
+#endif
 				if (csect + cc > fs->csize) {	/* Clip at cluster boundary */
+#if FF_FS_EXTENT
+					cc = ext_run(fp, csect, cc, 1);	/* or end of the contiguous clusters */
+#else
 					cc = fs->csize - csect;
+#endif
 				}
 				if (disk_write(fs->pdrv, wbuff, sect, cc) != RES_OK) ABORT(fs, FR_DISK_ERR);
+#if FF_FS_EXTENT == 2
+				ff_extent_stat(fs->pdrv, cc, 1);
+#endif
+#if FF_USE_PREALLOC
+				for (ncl = 1; fp->pa_ncl != 0 && ncl <= (csect + cc - 1) / fs->csize; ncl++) {	/* Update current cluster if the write goes over the cluster boundary in streaming mode */
+					fp->clust++;
+#if FF_FS_AUTOMAP
+					amap_add(fp, (DWORD)(fp->fptr / SS(fs) / fs->csize) + ncl, fp->clust);
+#endif
+				}
+#endif
 #if FF_FS_MINIMIZE <= 2
 #if FF_FS_TINY
 				if (fs->winsect - sect < cc) {	/* Refill sector cache if it gets invalidated by the direct write */
@@ -4143,172 +5649,367 @@ FRESULT f_write (
 
 
 
+#if FF_USE_RESERVE
 /*-----------------------------------------------------------------------*/
-/* Synchronize the File                                                  */
+/* Reserve the Sector Buffer to be Written at the File Pointer           */
 /*-----------------------------------------------------------------------*/
 
-FRESULT f_sync (
-	FIL* fp		/* Open file to be synced */
+FRESULT f_reserve (
+	FIL* fp,		/* Open file to be written */
+	BYTE** buff,	/* Pointer to the variable to return pointer to the sector buffer */
+	UINT* btr		/* Pointer to the variable to return number of bytes available in the buffer */
 )
 {
 	FRESULT res;
 	FATFS *fs;
-	DWORD tm;
-	BYTE *dir;
+	DWORD clst;
+	LBA_t sect;
+	UINT csect, n;
 
 
-	res = validate(&fp->obj, &fs);	/* Check validity of the file object */
-	if (res == FR_OK) {
-		if (fp->flag & FA_MODIFIED) {	/* Is there any change to the file? */
-#if !FF_FS_TINY
-			if (fp->flag & FA_DIRTY) {	/* Write-back cached data if needed */
-				if (disk_write(fs->pdrv, fp->buf, fp->sect, 1) != RES_OK) LEAVE_FF(fs, FR_DISK_ERR);
-				fp->flag &= (BYTE)~FA_DIRTY;
-			}
+	*btr = 0;
+	res = validate(&fp->obj, &fs);			/* Check validity of the file object */
+	if (res != FR_OK || (res = (FRESULT)fp->err) != FR_OK) LEAVE_FF(fs, res);	/* Check validity */
+	if (!(fp->flag & FA_WRITE)) LEAVE_FF(fs, FR_DENIED);	/* Check access mode */
+#if FF_FS_BUFPOOL
+	res = bpool_attach(fp, 1);				/* Get sector buffer from the pool */
+	if (res != FR_OK) LEAVE_FF(fs, res);
 #endif
-			/* Update the directory entry */
-			tm = GET_FATTIME();				/* Modified time */
-#if FF_FS_EXFAT
-			if (fs->fs_type == FS_EXFAT) {
-				res = fill_first_frag(&fp->obj);	/* Fill first fragment on the FAT if needed */
-				if (res == FR_OK) {
-					res = fill_last_frag(&fp->obj, fp->clust, 0xFFFFFFFF);	/* Fill last fragment on the FAT if needed */
-				}
-				if (res == FR_OK) {
-					DIR dj;
-					DEF_NAMBUF
 
-					INIT_NAMBUF(fs);
-					res = load_obj_xdir(&dj, &fp->obj);	/* Load directory entry block */
-					if (res == FR_OK) {
-						fs->dirbuf[XDIR_Attr] |= AM_ARC;				/* Set archive attribute to indicate that the file has been changed */
-						fs->dirbuf[XDIR_GenFlags] = fp->obj.stat | 1;	/* Update file allocation information */
-						st_dword(fs->dirbuf + XDIR_FstClus, fp->obj.sclust);		/* Update start cluster */
-						st_qword(fs->dirbuf + XDIR_FileSize, fp->obj.objsize);		/* Update file size */
-						st_qword(fs->dirbuf + XDIR_ValidFileSize, fp->obj.objsize);	/* (FatFs does not support Valid File Size feature) */
-						st_dword(fs->dirbuf + XDIR_ModTime, tm);		/* Update modified time */
-						fs->dirbuf[XDIR_ModTime10] = 0;
-						st_dword(fs->dirbuf + XDIR_AccTime, 0);
-						res = store_xdir(&dj);	/* Restore it to the directory */
-						if (res == FR_OK) {
-							res = sync_fs(fs);
-							fp->flag &= (BYTE)~FA_MODIFIED;
-						}
-					}
-					FREE_NAMBUF();
-				}
-			} else
-#endif
-			{
-				res = move_window(fs, fp->dir_sect);
-				if (res == FR_OK) {
-					dir = fp->dir_ptr;
-					dir[DIR_Attr] |= AM_ARC;						/* Set archive attribute to indicate that the file has been changed */
-					st_clust(fp->obj.fs, dir, fp->obj.sclust);		/* Update file allocation information  */
-					st_dword(dir + DIR_FileSize, (DWORD)fp->obj.objsize);	/* Update file size */
-					st_dword(dir + DIR_ModTime, tm);				/* Update modified time */
-					st_word(dir + DIR_LstAccDate, 0);
-					fs->wflag = 1;
-					res = sync_fs(fs);					/* Restore it to the directory */
-					fp->flag &= (BYTE)~FA_MODIFIED;
-				}
+	if (fp->fptr % SS(fs) == 0) {			/* On the sector boundary? */
+		csect = (UINT)(fp->fptr / SS(fs)) & (fs->csize - 1);	/* Sector offset in the cluster */
+		clst = fp->clust;
+		if (csect == 0) {					/* On the cluster boundary? */
+			clst = wr_clust(fp);			/* Follow or stretch cluster chain (fp->clust is updated at f_commit) */
+			if (clst == 0) LEAVE_FF(fs, FR_OK);	/* Could not allocate a new cluster (disk full) */
+			if (clst == 1) ABORT(fs, FR_INT_ERR);
+			if (clst == 0xFFFFFFFF) ABORT(fs, FR_DISK_ERR);
+		}
+		sect = clst2sect(fs, clst);			/* Get the sector at the file pointer */
+		if (sect == 0) ABORT(fs, FR_INT_ERR);
+		sect += csect;
+		if (sect != fp->sect) {				/* Need to change the sector in the buffer? */
+#if FF_FS_TINY
+			if (fs->winsect == fp->sect && sync_window(fs) != FR_OK) ABORT(fs, FR_DISK_ERR);	/* Write-back sector cache */
+			if (fp->fptr >= fp->obj.objsize) {	/* Avoid silly cache filling on the growing edge */
+				if (sync_window(fs) != FR_OK) ABORT(fs, FR_DISK_ERR);
+				fs->winsect = sect;
+			}
+#else
+			if (fp->flag & FA_DIRTY) {		/* Write-back sector cache */
+				if (disk_write(fs->pdrv, fp->buf, fp->sect, 1) != RES_OK) ABORT(fs, FR_DISK_ERR);
+				fp->flag &= (BYTE)~FA_DIRTY;
 			}
+			if (fp->fptr < fp->obj.objsize && disk_read(fs->pdrv, fp->buf, sect, 1) != RES_OK) {	/* Fill sector cache with file data */
+				ABORT(fs, FR_DISK_ERR);
+			}
+#endif
+			fp->sect = sect;
 		}
 	}
+	n = SS(fs) - (UINT)fp->fptr % SS(fs);	/* Number of bytes remains in the sector */
+	if ((!FF_FS_EXFAT || fs->fs_type != FS_EXFAT) && (DWORD)(fp->fptr + n) < (DWORD)fp->fptr) {
+		n = (UINT)(0xFFFFFFFF - (DWORD)fp->fptr);	/* Clip at 4 GiB - 1 at FAT volume */
+	}
+#if FF_FS_TINY
+	if (move_window(fs, fp->sect) != FR_OK) ABORT(fs, FR_DISK_ERR);	/* Move sector window */
+	*buff = fs->win + fp->fptr % SS(fs);
+#else
+	*buff = fp->buf + fp->fptr % SS(fs);
+#endif
+#if FF_FS_BUFPOOL
+	bpool_pin(fp, 1);						/* Keep the buffer until f_commit() */
+#endif
+	*btr = n;
 
-	LEAVE_FF(fs, res);
+	LEAVE_FF(fs, FR_OK);
 }
 
-#endif /* !FF_FS_READONLY */
-
 
 
 
 /*-----------------------------------------------------------------------*/
-/* Close File                                                            */
+/* Commit the Data Written in the Sector Buffer                          */
 /*-----------------------------------------------------------------------*/
 
-FRESULT f_close (
-	FIL* fp		/* Open file to be closed */
+FRESULT f_commit (
+	FIL* fp,		/* Open file to be written */
+	UINT btc		/* Number of bytes written in the buffer given by f_reserve() */
 )
 {
 	FRESULT res;
 	FATFS *fs;
+	DWORD clst;
+	UINT csect;
 
-#if !FF_FS_READONLY
-	res = f_sync(fp);					/* Flush cached data */
-	if (res == FR_OK)
+
+	res = validate(&fp->obj, &fs);			/* Check validity of the file object */
+	if (res != FR_OK || (res = (FRESULT)fp->err) != FR_OK) LEAVE_FF(fs, res);	/* Check validity */
+	if (!(fp->flag & FA_WRITE)) LEAVE_FF(fs, FR_DENIED);	/* Check access mode */
+#if FF_FS_BUFPOOL
+	bpool_pin(fp, 0);						/* Return the buffer to the pool */
 #endif
-	{
-		res = validate(&fp->obj, &fs);	/* Lock volume */
-		if (res == FR_OK) {
-#if FF_FS_LOCK
-			res = dec_share(fp->obj.lockid);		/* Decrement file open counter */
-			if (res == FR_OK) fp->obj.fs = 0;	/* Invalidate file object */
+	if (btc == 0) LEAVE_FF(fs, FR_OK);
+	if (btc > SS(fs) - (UINT)fp->fptr % SS(fs)) LEAVE_FF(fs, FR_INVALID_PARAMETER);	/* Over the reserved buffer? */
+#if FF_FS_READAHEAD
+	rahead_discard(fp);
+#endif
+
+#if FF_FS_TINY
+	if (fs->winsect != fp->sect) ABORT(fs, FR_INT_ERR);	/* The window has been moved after f_reserve() */
+	fs->wflag = 1;
 #else
-			fp->obj.fs = 0;	/* Invalidate file object */
+#if FF_FS_BUFPOOL
+	if (!fp->buf) ABORT(fs, FR_INT_ERR);	/* The buffer has been evicted after f_reserve() */
 #endif
-#if FF_FS_REENTRANT
-			unlock_volume(fs, FR_OK);		/* Unlock volume */
+	fp->flag |= FA_DIRTY;
+#endif
+	if (fp->fptr % SS(fs) == 0) {			/* On the sector boundary? */
+		csect = (UINT)(fp->fptr / SS(fs)) & (fs->csize - 1);	/* Sector offset in the cluster */
+		if (csect == 0) {					/* On the cluster boundary? */
+			clst = wr_clust(fp);			/* Follow the cluster chain prepared by f_reserve() */
+			if (clst == 0 || clst == 1) ABORT(fs, FR_INT_ERR);
+			if (clst == 0xFFFFFFFF) ABORT(fs, FR_DISK_ERR);
+			fp->clust = clst;				/* Update current cluster */
+#if FF_FS_AUTOMAP
+			amap_add(fp, (DWORD)(fp->fptr / SS(fs) / fs->csize), clst);	/* Add the cluster to the map if the chain is stretched */
 #endif
 		}
+		if (clst2sect(fs, fp->clust) + csect != fp->sect) ABORT(fs, FR_INT_ERR);	/* Is the sector reserved? */
 	}
-	return res;
+	fp->fptr += btc;
+	if (fp->fptr > fp->obj.objsize) fp->obj.objsize = fp->fptr;
+	fp->flag |= FA_MODIFIED;				/* Set file change flag */
+
+	LEAVE_FF(fs, FR_OK);
 }
 
+#endif /* FF_USE_RESERVE */
+
 
 
 
-#if FF_FS_RPATH >= 1
 /*-----------------------------------------------------------------------*/
-/* Change Current Directory or Current Drive, Get Current Directory      */
+/* Synchronize the File                                                  */
 /*-----------------------------------------------------------------------*/
 
-FRESULT f_chdrive (
-	const TCHAR* path		/* Drive number to set */
+FRESULT f_sync (
+	FIL* fp		/* Open file to be synced */
 )
 {
-	int vol;
+	FRESULT res;
+	FATFS *fs;
 
 
-	/* Get logical drive number */
-	vol = get_ldnumber(&path);
-	if (vol < 0) return FR_INVALID_DRIVE;
-	CurrVol = (BYTE)vol;	/* Set it as current volume */
+	res = validate(&fp->obj, &fs);	/* Check validity of the file object */
+	if (res == FR_OK) {
+		if (fp->flag & FA_MODIFIED) {	/* Is there any change to the file? */
+			res = sync_fobj(fp, GET_FATTIME());	/* Flush cached data and update the directory entry */
+			if (res == FR_OK) res = sync_fs(fs);
+		}
+	}
 
-	return FR_OK;
+	LEAVE_FF(fs, res);
 }
 
 
 
-FRESULT f_chdir (
-	const TCHAR* path	/* Pointer to the directory path */
+
+#if FF_USE_SYNCSET
+/*-----------------------------------------------------------------------*/
+/* Synchronize a Set of Files                                            */
+/*-----------------------------------------------------------------------*/
+
+FRESULT f_sync_set (
+	FIL* const fps[],	/* Pointer to the array of open files to be synced */
+	UINT nf				/* Number of files in the array */
 )
 {
-#if FF_STR_VOLUME_ID == 2
-	UINT i;
-#endif
 	FRESULT res;
-	DIR dj;
 	FATFS *fs;
-	DEF_NAMBUF
+	DWORD tm;
+	UINT i, j, nm;
 
 
-	/* Get logical drive */
-	res = mount_volume(&path, &fs, 0);
+	if (!fps || nf == 0) return FR_INVALID_PARAMETER;
+	res = validate(&fps[0]->obj, &fs);	/* Check validity of the first file object */
 	if (res == FR_OK) {
-		dj.obj.fs = fs;
-		INIT_NAMBUF(fs);
-		res = follow_path(&dj, path);		/* Follow the path */
-		if (res == FR_OK) {					/* Follow completed */
-			if (dj.fn[NSFLAG] & NS_NONAME) {	/* Is it the start directory itself? */
-				fs->cdir = dj.obj.sclust;
-#if FF_FS_EXFAT
-				if (fs->fs_type == FS_EXFAT) {
-					fs->cdc_scl = dj.obj.c_scl;
-					fs->cdc_size = dj.obj.c_size;
-					fs->cdc_ofs = dj.obj.c_ofs;
-				}
+		for (i = nm = 0; i < nf; i++) {	/* All files must be on the same volume */
+			if (!fps[i] || fps[i]->obj.fs != fs || fps[i]->obj.id != fs->id) LEAVE_FF(fs, FR_INVALID_OBJECT);
+			if (fps[i]->flag & FA_MODIFIED) nm++;
+		}
+		if (nm > 0) {	/* Is there any change to the files? */
+			tm = GET_FATTIME();
+			for (i = 0; res == FR_OK && i < nf; i++) {
+				if (fps[i]->flag & FA_MODIFIED) {
+					res = sync_fobj(fps[i], tm);
+					for (j = i + 1; res == FR_OK && j < nf; j++) {	/* Update the files in the same directory sector in succession */
+						if ((!FF_FS_EXFAT || fs->fs_type != FS_EXFAT) && (fps[j]->flag & FA_MODIFIED) && fps[j]->dir_sect == fps[i]->dir_sect) {
+							res = sync_fobj(fps[j], tm);
+						}
+					}
+				}
+			}
+			if (res == FR_OK) res = sync_fs(fs);	/* Flush the filesystem at a time */
+		}
+	}
+
+	LEAVE_FF(fs, res);
+}
+
+
+
+#if FF_FS_SYNCBATCH
+/*-----------------------------------------------------------------------*/
+/* Synchronize All Files Opened in Write Mode                            */
+/*-----------------------------------------------------------------------*/
+
+FRESULT f_sync_all (
+	const TCHAR* path	/* Logical drive number */
+)
+{
+	FRESULT res;
+	FATFS *fs;
+	FIL *fp;
+	DWORD tm;
+	UINT nm = 0;
+
+
+	res = mount_volume(&path, &fs, 0);	/* Get logical drive */
+	if (res == FR_OK) {
+		tm = GET_FATTIME();
+		for (fp = fs->flist; res == FR_OK && fp; fp = fp->fnext) {
+			if (fp->obj.fs == fs && fp->obj.id == fs->id && fp->err == 0 && (fp->flag & FA_MODIFIED)) {
+				res = sync_fobj(fp, tm);
+				nm++;
+			}
+		}
+		if (res == FR_OK && nm > 0) res = sync_fs(fs);	/* Flush the filesystem at a time */
+	}
+
+	LEAVE_FF(fs, res);
+}
+#endif
+
+#endif /* FF_USE_SYNCSET */
+
+#endif /* !FF_FS_READONLY */
+
+
+
+
+/*-----------------------------------------------------------------------*/
+/* Close File                                                            */
+/*-----------------------------------------------------------------------*/
+
+FRESULT f_close (
+	FIL* fp		/* Open file to be closed */
+)
+{
+	FRESULT res;
+	FATFS *fs;
+#if !FF_FS_READONLY && FF_USE_PREALLOC
+	FRESULT rp = FR_OK;
+#endif
+
+#if !FF_FS_READONLY
+#if FF_USE_PREALLOC
+	if ((fp->flag & FA_WRITE) && fp->err == 0) {
+		rp = f_prealloc(fp, 0);		/* Release unused preallocated clusters (the file is closed regardless of its result) */
+	}
+#endif
+	res = f_sync(fp);					/* Flush cached data */
+	if (res == FR_OK)
+#endif
+	{
+		res = validate(&fp->obj, &fs);	/* Lock volume */
+		if (res == FR_OK) {
+#if !FF_FS_READONLY && FF_FS_EOCHINT
+			if (fp->err == 0 && fp->fptr > 0 && fp->fptr == fp->obj.objsize && (!FF_FS_EXFAT || fs->fs_type != FS_EXFAT)) {	/* Save the last cluster for next append open */
+				eoch_store(fs, fp->dir_sect, (UINT)(fp->dir_ptr - fs->win), fp->obj.sclust, fp->obj.objsize, fp->clust);
+			}
+#endif
+#if FF_FS_LOCK
+			res = dec_share(fp->obj.lockid);		/* Decrement file open counter */
+			if (res == FR_OK) fp->obj.fs = 0;	/* Invalidate file object */
+#else
+			fp->obj.fs = 0;	/* Invalidate file object */
+#endif
+#if FF_FS_BUFPOOL
+			if (!fp->obj.fs) bpool_release(fp, 0);	/* Return the sector buffer to the pool */
+#endif
+#if FF_FS_SYNCBATCH
+			if (!fp->obj.fs) {				/* Remove the file from the list of writable files */
+				FIL **pp;
+
+				for (pp = &fs->flist; *pp && *pp != fp; pp = &(*pp)->fnext) ;
+				if (*pp) *pp = fp->fnext;
+			}
+#endif
+#if FF_FS_REENTRANT
+			unlock_volume(fs, FR_OK);		/* Unlock volume */
+#endif
+		}
+	}
+#if !FF_FS_READONLY && FF_USE_PREALLOC
+	if (res == FR_OK) res = rp;
+#endif
+	return res;
+}
+
+
+
+
+#if FF_FS_RPATH >= 1
+/*-----------------------------------------------------------------------*/
+/* Change Current Directory or Current Drive, Get Current Directory      */
+/*-----------------------------------------------------------------------*/
+
+FRESULT f_chdrive (
+	const TCHAR* path		/* Drive number to set */
+)
+{
+	int vol;
+
+
+	/* Get logical drive number */
+	vol = get_ldnumber(&path);
+	if (vol < 0) return FR_INVALID_DRIVE;
+	CurrVol = (BYTE)vol;	/* Set it as current volume */
+
+	return FR_OK;
+}
+
+
+
+FRESULT f_chdir (
+	const TCHAR* path	/* Pointer to the directory path */
+)
+{
+#if FF_STR_VOLUME_ID == 2
+	UINT i;
+#endif
+	FRESULT res;
+	DIR dj;
+	FATFS *fs;
+	DEF_NAMBUF
+
+
+	/* Get logical drive */
+	res = mount_volume(&path, &fs, 0);
+	if (res == FR_OK) {
+		dj.obj.fs = fs;
+		INIT_NAMBUF(fs);
+		res = follow_path(&dj, path);		/* Follow the path */
+		if (res == FR_OK) {					/* Follow completed */
+			if (dj.fn[NSFLAG] & NS_NONAME) {	/* Is it the start directory itself? */
+				fs->cdir = dj.obj.sclust;
+#if FF_FS_EXFAT
+				if (fs->fs_type == FS_EXFAT) {
+					fs->cdc_scl = dj.obj.c_scl;
+					fs->cdc_size = dj.obj.c_size;
+					fs->cdc_ofs = dj.obj.c_ofs;
+				}
 #endif
 			} else {
 				if (dj.obj.attr & AM_DIR) {	/* It is a sub-directory */
@@ -4455,6 +6156,9 @@ FRESULT f_lseek (
 	DWORD clst, bcs;
 	LBA_t nsect;
 	FSIZE_t ifptr;
+#if FF_FS_AUTOMAP
+	DWORD ci, cc;
+#endif
 #if FF_USE_FASTSEEK
 	DWORD cl, pcl, ncl, tcl, tlen, ulen;
 	DWORD *tbl;
@@ -4469,6 +6173,10 @@ FRESULT f_lseek (
 	}
 #endif
 	if (res != FR_OK) LEAVE_FF(fs, res);
+#if FF_FS_BUFPOOL
+	res = bpool_attach(fp, 0);			/* Get sector buffer from the pool before moving the file pointer */
+	if (res != FR_OK) LEAVE_FF(fs, res);
+#endif
 
 #if FF_USE_FASTSEEK
 	if (fp->cltbl) {	/* Fast seek */
@@ -4547,10 +6255,31 @@ FRESULT f_lseek (
 					if (clst == 1) ABORT(fs, FR_INT_ERR);
 					if (clst == 0xFFFFFFFF) ABORT(fs, FR_DISK_ERR);
 					fp->obj.sclust = clst;
+#if FF_FS_AUTOMAP
+					amap_add(fp, 0, clst);
+#endif
 				}
 #endif
 				fp->clust = clst;
 			}
+#if FF_FS_AUTOMAP
+			if (clst != 0 && ofs > bcs) {				/* Skip the cluster following with the cluster map */
+				if (fp->am_stat == 0) {
+					res = amap_build(fp);
+					if (res != FR_OK) ABORT(fs, res);
+				}
+				cc = (DWORD)(fp->fptr / bcs);			/* Current cluster order */
+				ci = cc + (DWORD)((ofs - 1) / bcs);		/* Target cluster order */
+				if (ci >= fp->am_ncl) ci = fp->am_ncl - 1;	/* Clip at end of the map */
+				if (fp->am_ncl > 0 && ci > cc) {
+					clst = amap_clust(fp, ci);
+					if (clst == 0) ABORT(fs, FR_INT_ERR);
+					fp->fptr += (FSIZE_t)(ci - cc) * bcs;
+					ofs -= (FSIZE_t)(ci - cc) * bcs;
+					fp->clust = clst;
+				}
+			}
+#endif
 			if (clst != 0) {
 				while (ofs > bcs) {						/* Cluster following loop */
 					ofs -= bcs; fp->fptr += bcs;
@@ -4572,6 +6301,9 @@ FRESULT f_lseek (
 					if (clst == 0xFFFFFFFF) ABORT(fs, FR_DISK_ERR);
 					if (clst <= 1 || clst >= fs->n_fatent) ABORT(fs, FR_INT_ERR);
 					fp->clust = clst;
+#if FF_FS_AUTOMAP
+					amap_add(fp, (DWORD)(fp->fptr / bcs), clst);	/* Add the cluster to the map if the chain is stretched */
+#endif
 				}
 				fp->fptr += ofs;
 				if (ofs % SS(fs)) {
@@ -4741,6 +6473,101 @@ FRESULT f_readdir (
 /* Find Next File                                                        */
 /*-----------------------------------------------------------------------*/
 
+#if !FF_USE_LFN
+/* On the non-LFN configuration, the pattern is compiled into an SFN template
+/  in dp->fn[] (0:any char) that is compared with the raw directory entry, so
+/  that the entries which can never match the pattern are skipped without
+/  creating the file information. */
+
+static const TCHAR* find_field (	/* Compile a field of the pattern into the template (0:cannot be compiled) */
+	BYTE* tp,			/* Pointer to the template field */
+	UINT n,				/* Size of the field */
+	const TCHAR* pp		/* Pointer to the pattern field */
+)
+{
+	UINT i = 0;
+	BYTE c;
+
+
+	while (*pp && *pp != '.') {
+		c = (BYTE)*pp++;
+		if (c == '*') {				/* The rest of field can be any */
+			while (i < n) tp[i++] = 0;
+			continue;
+		}
+		if (dbc_1st(c)) {			/* DBC is not compiled (any char for both bytes) */
+			c = (BYTE)*pp;
+			if (!dbc_2nd(c) || c == '*' || c == '\?' || c == '.') return 0;	/* Broken DBC */
+			pp++;
+			if (i < n) tp[i++] = 0;
+			if (i < n) tp[i++] = 0;
+			continue;
+		}
+		if (i < n) {				/* Wildcard and extended chars are any char */
+			tp[i++] = (c == '\?' || c >= 0x80) ? 0 : IsLower(c) ? c - 0x20 : c;
+		}
+	}
+	return pp;
+}
+
+
+static void find_compile (
+	DIR* dp				/* Directory object with the pattern */
+)
+{
+	const TCHAR *pp;
+	UINT i;
+
+
+	memset(dp->fn, ' ', 11);		/* Unused chars in the field must be blank */
+	pp = find_field(dp->fn, 8, dp->pat);	/* Body */
+	if (pp && *pp == '.') {
+		pp = find_field(dp->fn + 8, 3, pp + 1);	/* Extension */
+	}
+	if (!pp || *pp) {			/* Broken DBC or two or more dots (cannot be compiled) */
+		memset(dp->fn, 0, 11);
+		return;
+	}
+	for (i = 0; dp->pat[i] && dp->pat[i] != '.'; i++) ;
+	if (!dp->pat[i]) {	/* The dot of name can be matched by a wildcard when no dot is in the pattern */
+		for (i = 0; dp->pat[i] && dp->pat[i] != '\?' && dp->pat[i] != '*'; i++) ;
+		if (dp->pat[i]) {
+			if (i > 8) i = 8;
+			memset(dp->fn + i, 0, 11 - i);
+		}
+	}
+}
+
+
+static FRESULT find_skip (	/* Skip the entries which do not match the template */
+	DIR* dp				/* Directory object with the compiled pattern */
+)
+{
+	FRESULT res;
+	FATFS *fs;
+	BYTE c;
+	UINT i;
+
+
+	res = validate(&dp->obj, &fs);
+	while (res == FR_OK && dp->sect) {
+		res = move_window(fs, dp->sect);
+		if (res != FR_OK) break;
+		c = dp->dir[DIR_Name];
+		if (c == 0) break;			/* End of directory */
+		if (c != DDEM && c != '.') {
+			if (dp->dir[DIR_Attr] & AM_VOL) break;	/* Leave label and LFN entries to f_readdir() */
+			for (i = 0; i < 11 && (dp->fn[i] == 0 || dp->fn[i] == dp->dir[i]); i++) ;
+			if (i == 11) break;		/* Can be matched */
+		}
+		res = dir_next(dp, 0);
+	}
+	if (res == FR_NO_FILE) res = FR_OK;
+	LEAVE_FF(fs, res);
+}
+#endif
+
+
 FRESULT f_findnext (
 	DIR* dp,		/* Pointer to the open directory object */
 	FILINFO* fno	/* Pointer to the file information structure */
@@ -4750,6 +6577,12 @@ FRESULT f_findnext (
 
 
 	for (;;) {
+#if !FF_USE_LFN
+		if (fno) {
+			res = find_skip(dp);		/* Skip the entries never matched */
+			if (res != FR_OK) break;
+		}
+#endif
 		res = f_readdir(dp, fno);		/* Get a directory item */
 		if (res != FR_OK || !fno || !fno->fname[0]) break;	/* Terminate if any error or end of directory */
 		if (pattern_match(dp->pat, fno->fname, 0, FIND_RECURS)) break;		/* Test for the file name */
@@ -4779,6 +6612,9 @@ FRESULT f_findfirst (
 	dp->pat = pattern;		/* Save pointer to pattern string */
 	res = f_opendir(dp, path);		/* Open the target directory */
 	if (res == FR_OK) {
+#if !FF_USE_LFN
+		find_compile(dp);			/* Compile the pattern */
+#endif
 		res = f_findnext(dp, fno);	/* Find the first item */
 	}
 	return res;
@@ -4788,62 +6624,244 @@ FRESULT f_findfirst (
 
 
 
-#if FF_FS_MINIMIZE == 0
+#if FF_USE_FINDTIME
 /*-----------------------------------------------------------------------*/
-/* Get File Status                                                       */
+/* Find Next File in the Timestamp Range                                 */
 /*-----------------------------------------------------------------------*/
 
-FRESULT f_stat (
-	const TCHAR* path,	/* Pointer to the file path */
-	FILINFO* fno		/* Pointer to file information to return */
+#define TF_OFS		(FF_USE_FINDTIME == 2 ? DIR_CrtTime : DIR_ModTime)	/* Timestamp field in the SFN entry */
+#define TF_XOFS		(FF_USE_FINDTIME == 2 ? XDIR_CrtTime : XDIR_ModTime)	/* Timestamp field in the exFAT file entry */
+
+
+static FRESULT time_skip (	/* Skip the FAT entries out of the timestamp range */
+	DIR* dp,			/* Directory object */
+	DWORD t1,			/* Timestamp range to be matched */
+	DWORD t2
 )
 {
-	FRESULT res;
-	DIR dj;
-	DEF_NAMBUF
+	FRESULT res = FR_OK;
+	FATFS *fs = dp->obj.fs;
+	BYTE c, a;
+	DWORD tm;
+#if FF_USE_LFN
+	DWORD bofs = 0xFFFFFFFF, bclst = 0;
+	LBA_t bsect = 0;
+#endif
 
 
-	/* Get logical drive */
-	res = mount_volume(&path, &dj.obj.fs, 0);
-	if (res == FR_OK) {
-		INIT_NAMBUF(dj.obj.fs);
-		res = follow_path(&dj, path);	/* Follow the file path */
-		if (res == FR_OK) {				/* Follow completed */
-			if (dj.fn[NSFLAG] & NS_NONAME) {	/* It is origin directory */
-				res = FR_INVALID_NAME;
-			} else {							/* Found an object */
-				if (fno) get_fileinfo(&dj, fno);
+	while (dp->sect) {
+		res = move_window(fs, dp->sect);
+		if (res != FR_OK) break;
+		c = dp->dir[DIR_Name];
+		if (c == 0) break;			/* End of directory */
+		a = dp->dir[DIR_Attr] & AM_MASK;
+#if FF_USE_LFN
+		if (a == AM_LFN && c != DDEM) {		/* LFN entry (it is read with the SFN entry if matched) */
+			if (bofs == 0xFFFFFFFF) {
+				bofs = dp->dptr; bclst = dp->clust; bsect = dp->sect;
+			}
+		} else {
+			if (c != DDEM && c != '.' && (a & ~AM_ARC) != AM_VOL) {	/* SFN entry */
+				tm = ld_dword(dp->dir + TF_OFS);
+				if (tm >= t1 && tm <= t2) {	/* Matched, go back to top of the entry block */
+					if (bofs != 0xFFFFFFFF) {
+						dp->dptr = bofs; dp->clust = bclst; dp->sect = bsect;
+						dp->dir = fs->win + bofs % SS(fs);
+					}
+					break;
+				}
 			}
+			bofs = 0xFFFFFFFF;
 		}
-		FREE_NAMBUF();
+#else
+		if (c != DDEM && c != '.' && (a & ~AM_ARC) != AM_VOL) {
+			tm = ld_dword(dp->dir + TF_OFS);
+			if (tm >= t1 && tm <= t2) break;	/* Matched */
+		}
+#endif
+		res = dir_next(dp, 0);
 	}
-
-	LEAVE_FF(dj.obj.fs, res);
+	if (res == FR_NO_FILE) res = FR_OK;
+	return res;
 }
 
 
-
-#if !FF_FS_READONLY
-/*-----------------------------------------------------------------------*/
-/* Get Number of Free Clusters                                           */
-/*-----------------------------------------------------------------------*/
-
-FRESULT f_getfree (
-	const TCHAR* path,	/* Logical drive number */
-	DWORD* nclst,		/* Pointer to a variable to return number of free clusters */
-	FATFS** fatfs		/* Pointer to a pointer to return corresponding filesystem object */
+static FRESULT time_next (	/* Find the next entry in the timestamp range and read it (FR_NO_FILE:End of directory) */
+	DIR* dp,			/* Directory object */
+	DWORD t1,			/* Timestamp range to be matched */
+	DWORD t2,
+	DWORD* tm			/* Pointer to return the timestamp of the entry */
 )
 {
 	FRESULT res;
-	FATFS *fs;
-	DWORD nfree, clst, stat;
-	LBA_t sect;
-	UINT i;
-	FFOBJID obj;
+	FATFS *fs = dp->obj.fs;
 
 
-	/* Get logical drive */
-	res = mount_volume(&path, &fs, 0);
+	for (;;) {
+		if (!FF_FS_EXFAT || fs->fs_type != FS_EXFAT) {
+			res = time_skip(dp, t1, t2);	/* Skip the entries out of range without reading the name */
+			if (res != FR_OK) break;
+		}
+		res = DIR_READ_FILE(dp);	/* Read an item */
+		if (res != FR_OK) break;
+#if FF_FS_EXFAT
+		*tm = ld_dword((fs->fs_type == FS_EXFAT) ? fs->dirbuf + TF_XOFS : dp->dir + TF_OFS);
+#else
+		*tm = ld_dword(dp->dir + TF_OFS);
+#endif
+		if (*tm >= t1 && *tm <= t2) break;	/* In the range? */
+		res = dir_next(dp, 0);
+		if (res != FR_OK) break;
+	}
+	return res;
+}
+
+
+FRESULT f_findtime_next (
+	DIR* dp,		/* Pointer to the open directory object */
+	FILINFO* fno	/* Pointer to the file information structure */
+)
+{
+	FRESULT res;
+	FATFS *fs;
+	DWORD tm, tn, hi, ofs;
+	DEF_NAMBUF
+
+
+	res = validate(&dp->obj, &fs);	/* Check validity of the directory object */
+	if (res == FR_OK) {
+		if (!fno) {
+			res = dir_sdi(dp, 0);		/* Rewind the directory object */
+			dp->tcur = dp->tmin;
+		} else {
+			INIT_NAMBUF(fs);
+			res = time_next(dp, dp->tcur, dp->tcur, &tm);	/* Find the next entry of the current timestamp */
+			while (res == FR_NO_FILE && dp->tcur < dp->tmax) {	/* Go to the next timestamp if no more entry */
+				ofs = 0xFFFFFFFF; tn = 0; hi = dp->tmax;
+				res = dir_sdi(dp, 0);
+				while (res == FR_OK) {	/* Find the oldest timestamp newer than the current one and its first entry */
+					res = time_next(dp, dp->tcur + 1, hi, &tm);
+					if (res != FR_OK) break;
+					tn = tm;
+					ofs = dp->dptr;		/* Top of the entry block */
+#if FF_USE_LFN
+					if (dp->blk_ofs != 0xFFFFFFFF) ofs = dp->blk_ofs;
+#endif
+					if (tn == dp->tcur + 1) break;	/* No older one can exist */
+					hi = tn - 1;
+					res = dir_next(dp, 0);
+				}
+				if (res != FR_OK && res != FR_NO_FILE) break;
+				if (ofs == 0xFFFFFFFF) {	/* No more timestamp in the range */
+					dp->tcur = dp->tmax; res = FR_NO_FILE;
+					break;
+				}
+				dp->tcur = tn;
+				res = dir_sdi(dp, ofs);		/* Read the first entry of the timestamp */
+				if (res == FR_OK) res = time_next(dp, dp->tcur, dp->tcur, &tm);
+			}
+			if (res == FR_NO_FILE) res = FR_OK;	/* Ignore end of directory */
+			if (res == FR_OK) {
+				get_fileinfo(dp, fno);		/* Get the object information (null string at end of directory) */
+				if (dp->sect) {
+					res = dir_next(dp, 0);	/* Increment index for next */
+					if (res == FR_NO_FILE) res = FR_OK;
+				}
+			}
+			FREE_NAMBUF();
+		}
+	}
+	LEAVE_FF(fs, res);
+}
+
+
+
+/*-----------------------------------------------------------------------*/
+/* Find First File in the Timestamp Range                                */
+/*-----------------------------------------------------------------------*/
+
+FRESULT f_findtime_first (
+	DIR* dp,				/* Pointer to the blank directory object */
+	FILINFO* fno,			/* Pointer to the file information structure */
+	const TCHAR* path,		/* Pointer to the directory to open */
+	DWORD tmin,				/* Oldest timestamp to be found (in the format of get_fattime()) */
+	DWORD tmax				/* Newest timestamp to be found */
+)
+{
+	FRESULT res;
+
+
+	res = f_opendir(dp, path);		/* Open the target directory */
+	if (res == FR_OK) {
+		dp->tmin = dp->tcur = tmin; dp->tmax = tmax;
+		res = f_findtime_next(dp, fno);	/* Find the first item */
+	}
+	return res;
+}
+
+#endif	/* FF_USE_FINDTIME */
+
+
+
+#if FF_FS_MINIMIZE == 0
+/*-----------------------------------------------------------------------*/
+/* Get File Status                                                       */
+/*-----------------------------------------------------------------------*/
+
+FRESULT f_stat (
+	const TCHAR* path,	/* Pointer to the file path */
+	FILINFO* fno		/* Pointer to file information to return */
+)
+{
+	FRESULT res;
+	DIR dj;
+	DEF_NAMBUF
+
+
+	/* Get logical drive */
+	res = mount_volume(&path, &dj.obj.fs, 0);
+	if (res == FR_OK) {
+		INIT_NAMBUF(dj.obj.fs);
+		res = follow_path(&dj, path);	/* Follow the file path */
+		if (res == FR_OK) {				/* Follow completed */
+			if (dj.fn[NSFLAG] & NS_NONAME) {	/* It is origin directory */
+				res = FR_INVALID_NAME;
+			} else {							/* Found an object */
+				if (fno) get_fileinfo(&dj, fno);
+			}
+		}
+		FREE_NAMBUF();
+	}
+
+	LEAVE_FF(dj.obj.fs, res);
+}
+
+
+
+#if !FF_FS_READONLY
+/*-----------------------------------------------------------------------*/
+/* Get Number of Free Clusters                                           */
+/*-----------------------------------------------------------------------*/
+
+FRESULT f_getfree (
+	const TCHAR* path,	/* Logical drive number */
+	DWORD* nclst,		/* Pointer to a variable to return number of free clusters */
+	FATFS** fatfs		/* Pointer to a pointer to return corresponding filesystem object */
+)
+{
+	FRESULT res;
+	FATFS *fs;
+	DWORD nfree, clst, stat;
+	LBA_t sect;
+	UINT i;
+	FFOBJID obj;
+
+
+	/* Get logical drive */
+	res = mount_volume(&path, &fs, 0);
+#if FF_FS_LAZYFREE
+	if (res == FR_OK) res = free_step(fs, 0);	/* Complete counting free clusters */
+#endif
 	if (res == FR_OK) {
 		*fatfs = fs;				/* Return ptr to the fs object */
 		/* If free_clst is valid, return it without full FAT scan */
@@ -4936,6 +6954,9 @@ FRESULT f_truncate (
 	res = validate(&fp->obj, &fs);	/* Check validity of the file object */
 	if (res != FR_OK || (res = (FRESULT)fp->err) != FR_OK) LEAVE_FF(fs, res);
 	if (!(fp->flag & FA_WRITE)) LEAVE_FF(fs, FR_DENIED);	/* Check access mode */
+#if FF_FS_READAHEAD
+	rahead_discard(fp);
+#endif
 
 	if (fp->fptr < fp->obj.objsize) {	/* Process when fptr is not on the eof */
 		if (fp->fptr == 0) {	/* When set file size to zero, remove entire cluster chain */
@@ -4952,6 +6973,12 @@ FRESULT f_truncate (
 		}
 		fp->obj.objsize = fp->fptr;	/* Set file size to current read/write point */
 		fp->flag |= FA_MODIFIED;
+#if FF_FS_AUTOMAP
+		fp->am_stat = 0;			/* Discard the cluster map */
+#endif
+#if FF_USE_PREALLOC
+		fp->pa_len = 0;				/* Discard the preallocated region */
+#endif
 #if !FF_FS_TINY
 		if (res == FR_OK && (fp->flag & FA_DIRTY)) {
 			if (disk_write(fs->pdrv, fp->buf, fp->sect, 1) != RES_OK) {
@@ -5110,6 +7137,9 @@ FRESULT f_mkdir (
 						fs->win[SZDIRE + 1] = '.'; pcl = dj.obj.sclust;
 						st_clust(fs, fs->win + SZDIRE, pcl);
 						fs->wflag = 1;
+#if FF_FS_DIRHINT
+						dhint_store(fs, dcl, SZDIRE, dcl, 0);	/* Only dot entries are in use (replaces a stale hint of the cluster) */
+#endif
 					}
 					res = dir_register(&dj);	/* Register the object to the parent directory */
 				}
@@ -5540,205 +7570,1365 @@ FRESULT f_setlabel (
 					memcpy(dj.dir, dirvn, 11);	/* Change the volume label */
 				} else {
 					dj.dir[DIR_Name] = DDEM;	/* Remove the volume label */
+#if FF_FS_DIRHINT
+					dhint_store(fs, 0, dj.dptr, dj.clust, 1);
+#endif
+				}
+			}
+			fs->wflag = 1;
+			res = sync_fs(fs);
+		} else {			/* No volume label entry or an error */
+			if (res == FR_NO_FILE) {
+				res = FR_OK;
+				if (di != 0) {	/* Create a volume label entry */
+					res = dir_alloc(&dj, 1);	/* Allocate an entry */
+					if (res == FR_OK) {
+						memset(dj.dir, 0, SZDIRE);	/* Clean the entry */
+						if (FF_FS_EXFAT && fs->fs_type == FS_EXFAT) {
+							dj.dir[XDIR_Type] = ET_VLABEL;	/* Create volume label entry */
+							dj.dir[XDIR_NumLabel] = (BYTE)di;
+							memcpy(dj.dir + XDIR_Label, dirvn, 22);
+						} else {
+							dj.dir[DIR_Attr] = AM_VOL;		/* Create volume label entry */
+							memcpy(dj.dir, dirvn, 11);
+						}
+						fs->wflag = 1;
+						res = sync_fs(fs);
+					}
+				}
+			}
+		}
+	}
+
+	LEAVE_FF(fs, res);
+}
+
+#endif /* !FF_FS_READONLY */
+#endif /* FF_USE_LABEL */
+
+
+
+#if FF_USE_EXPAND && !FF_FS_READONLY
+/*-----------------------------------------------------------------------*/
+/* Allocate a Contiguous Blocks to the File                              */
+/*-----------------------------------------------------------------------*/
+
+FRESULT f_expand (
+	FIL* fp,		/* Pointer to the file object */
+	FSIZE_t fsz,	/* File size to be expanded to */
+	BYTE opt		/* Operation mode 0:Find and prepare or 1:Find and allocate */
+)
+{
+	FRESULT res;
+	FATFS *fs;
+	DWORD n, clst, stcl, scl, tcl, lclst;
+
+
+	res = validate(&fp->obj, &fs);		/* Check validity of the file object */
+	if (res != FR_OK || (res = (FRESULT)fp->err) != FR_OK) LEAVE_FF(fs, res);
+	if (fsz == 0 || fp->obj.objsize != 0 || !(fp->flag & FA_WRITE)) LEAVE_FF(fs, FR_DENIED);
+#if FF_FS_EXFAT
+	if (fs->fs_type != FS_EXFAT && fsz >= 0x100000000) LEAVE_FF(fs, FR_DENIED);	/* Check if in size limit */
+#endif
+	n = (DWORD)fs->csize * SS(fs);	/* Cluster size */
+	tcl = (DWORD)(fsz / n) + ((fsz & (n - 1)) ? 1 : 0);	/* Number of clusters required */
+#if FF_FS_LAZYFREE
+	if (fs->fsi_flag & 0x40) load_fsinfo(fs);
+#endif
+	stcl = fs->last_clst; lclst = 0;
+	if (stcl < 2 || stcl >= fs->n_fatent) stcl = 2;
+
+#if FF_FS_EXFAT
+	if (fs->fs_type == FS_EXFAT) {
+		scl = find_bitmap(fs, stcl, tcl);			/* Find a contiguous cluster block */
+		if (scl == 0) res = FR_DENIED;				/* No contiguous cluster block was found */
+		if (scl == 0xFFFFFFFF) res = FR_DISK_ERR;
+		if (res == FR_OK) {	/* A contiguous free area is found */
+			if (opt) {		/* Allocate it now */
+				res = change_bitmap(fs, scl, tcl, 1);	/* Mark the cluster block 'in use' */
+				lclst = scl + tcl - 1;
+			} else {		/* Set it as suggested point for next allocation */
+				lclst = scl - 1;
+			}
+		}
+	} else
+#endif
+	{
+		scl = find_contig(&fp->obj, stcl, tcl);		/* Find a contiguous cluster block */
+		if (scl == 0) res = FR_DENIED;				/* No contiguous cluster block was found */
+		if (scl == 1) res = FR_INT_ERR;
+		if (scl == 0xFFFFFFFF) res = FR_DISK_ERR;
+		if (res == FR_OK) {	/* A contiguous free area is found */
+			if (opt) {		/* Allocate it now */
+				for (clst = scl, n = tcl; n; clst++, n--) {	/* Create a cluster chain on the FAT */
+					res = put_fat(fs, clst, (n == 1) ? 0xFFFFFFFF : clst + 1);
+					if (res != FR_OK) break;
+					lclst = clst;
+				}
+			} else {		/* Set it as suggested point for next allocation */
+				lclst = scl - 1;
+			}
+		}
+	}
+
+	if (res == FR_OK) {
+		fs->last_clst = lclst;		/* Set suggested start cluster to start next */
+		if (opt) {	/* Is it allocated now? */
+			fp->obj.sclust = scl;		/* Update object allocation information */
+			fp->obj.objsize = fsz;
+			if (FF_FS_EXFAT) fp->obj.stat = 2;	/* Set status 'contiguous chain' */
+			fp->flag |= FA_MODIFIED;
+#if FF_FS_AUTOMAP
+			fp->am_stat = 1; fp->am_cnt = 1; fp->am_ncl = tcl;	/* Cluster map with a fragment */
+			fp->am_tbl[0] = tcl; fp->am_tbl[1] = scl;
+#endif
+			if (fs->free_clst <= fs->n_fatent - 2) {	/* Update FSINFO */
+				fs->free_clst -= tcl;
+				fs->fsi_flag |= 1;
+			}
+#if FF_FS_LAZYFREE
+			free_track(fs, scl, tcl, 1);
+#endif
+		}
+	}
+
+	LEAVE_FF(fs, res);
+}
+
+#endif /* FF_USE_EXPAND && !FF_FS_READONLY */
+
+
+
+#if FF_USE_PREALLOC && !FF_FS_READONLY
+/*-----------------------------------------------------------------------*/
+/* Set Streaming Mode with Contiguous Preallocation                      */
+/*-----------------------------------------------------------------------*/
+
+FRESULT f_prealloc (
+	FIL* fp,		/* Pointer to the file object */
+	FSIZE_t csz		/* Size of the preallocation chunk (0:Exit streaming mode) */
+)
+{
+	FRESULT res;
+	FATFS *fs;
+	DWORD bcs, ncl;
+
+
+	res = validate(&fp->obj, &fs);		/* Check validity of the file object */
+	if (res != FR_OK || (res = (FRESULT)fp->err) != FR_OK) LEAVE_FF(fs, res);
+	bcs = (DWORD)fs->csize * SS(fs);	/* Cluster size */
+
+	if (csz == 0) {		/* Exit streaming mode */
+		if (fp->pa_len != 0) {	/* Release unused clusters in the preallocated region */
+			ncl = (DWORD)((fp->obj.objsize + bcs - 1) / bcs);	/* Number of clusters in use */
+			if (ncl < fp->pa_ci + fp->pa_len) {		/* Is there any unused cluster at end of the chain? */
+				if (ncl > fp->pa_ci) {		/* Release the tail of the region */
+					res = remove_chain(&fp->obj, fp->pa_top + (ncl - fp->pa_ci), fp->pa_top + (ncl - fp->pa_ci) - 1);
+				} else {					/* Release whole region */
+					res = remove_chain(&fp->obj, fp->pa_top, fp->pa_prev);
+					if (fp->pa_prev == 0) fp->obj.sclust = 0;
+				}
+				fp->flag |= FA_MODIFIED;
+#if FF_FS_AUTOMAP
+				fp->am_stat = 0;	/* Discard the cluster map */
+#endif
+			}
+		}
+		fp->pa_ncl = 0; fp->pa_len = 0;
+		if (res != FR_OK) ABORT(fs, res);
+		LEAVE_FF(fs, FR_OK);
+	}
+
+	if (!(fp->flag & FA_WRITE) || (FF_FS_EXFAT && fs->fs_type == FS_EXFAT)) LEAVE_FF(fs, FR_DENIED);
+#if FF_FS_EXFAT
+	if (csz >= 0x100000000) LEAVE_FF(fs, FR_DENIED);
+#endif
+	ncl = (DWORD)(csz / bcs) + ((csz & (bcs - 1)) ? 1 : 0);	/* Number of clusters per chunk */
+	if (ncl > fs->n_fatent - 2) LEAVE_FF(fs, FR_DENIED);
+	fp->pa_ncl = ncl;
+
+	LEAVE_FF(fs, FR_OK);
+}
+
+#endif /* FF_USE_PREALLOC && !FF_FS_READONLY */
+
+
+
+#if FF_FS_LAZYFREE
+/*-----------------------------------------------------------------------*/
+/* Count Free Clusters in Steps                                          */
+/*-----------------------------------------------------------------------*/
+
+FRESULT f_getfree_step (
+	const TCHAR* path,	/* Logical drive number */
+	UINT nsect,			/* Maximum number of sectors to be read in this call (0:until completed) */
+	DWORD* nclst		/* Pointer to a variable to return number of free clusters (0xFFFFFFFF:not counted yet) */
+)
+{
+	FRESULT res;
+	FATFS *fs;
+
+
+	res = mount_volume(&path, &fs, 0);
+	if (res == FR_OK) {
+		res = free_step(fs, nsect);
+		*nclst = (fs->free_clst <= fs->n_fatent - 2) ? fs->free_clst : 0xFFFFFFFF;
+	}
+	LEAVE_FF(fs, res);
+}
+
+#endif /* FF_FS_LAZYFREE */
+
+
+
+#if FF_USE_FORWARD
+/*-----------------------------------------------------------------------*/
+/* Forward Data to the Stream Directly                                   */
+/*-----------------------------------------------------------------------*/
+
+FRESULT f_forward (
+	FIL* fp, 						/* Pointer to the file object */
+	UINT (*func)(const BYTE*,UINT),	/* Pointer to the streaming function */
+	UINT btf,						/* Number of bytes to forward */
+	UINT* bf						/* Pointer to number of bytes forwarded */
+)
+{
+	FRESULT res;
+	FATFS *fs;
+	DWORD clst;
+	LBA_t sect;
+	FSIZE_t remain;
+	UINT rcnt, csect;
+	BYTE *dbuf;
+
+
+	*bf = 0;	/* Clear transfer byte counter */
+	res = validate(&fp->obj, &fs);		/* Check validity of the file object */
+	if (res != FR_OK || (res = (FRESULT)fp->err) != FR_OK) LEAVE_FF(fs, res);
+	if (!(fp->flag & FA_READ)) LEAVE_FF(fs, FR_DENIED);	/* Check access mode */
+#if FF_FS_BUFPOOL
+	res = bpool_attach(fp, 1);			/* Get sector buffer from the pool */
+	if (res != FR_OK) LEAVE_FF(fs, res);
+#endif
+
+	remain = fp->obj.objsize - fp->fptr;
+	if (btf > remain) btf = (UINT)remain;			/* Truncate btf by remaining bytes */
+
+	for ( ; btf > 0 && (*func)(0, 0); fp->fptr += rcnt, *bf += rcnt, btf -= rcnt) {	/* Repeat until all data transferred or stream goes busy */
+		csect = (UINT)(fp->fptr / SS(fs) & (fs->csize - 1));	/* Sector offset in the cluster */
+		if (fp->fptr % SS(fs) == 0) {				/* On the sector boundary? */
+			if (csect == 0) {						/* On the cluster boundary? */
+				clst = (fp->fptr == 0) ?			/* On the top of the file? */
+					fp->obj.sclust : get_fat(&fp->obj, fp->clust);
+				if (clst <= 1) ABORT(fs, FR_INT_ERR);
+				if (clst == 0xFFFFFFFF) ABORT(fs, FR_DISK_ERR);
+				fp->clust = clst;					/* Update current cluster */
+			}
+		}
+		sect = clst2sect(fs, fp->clust);			/* Get current data sector */
+		if (sect == 0) ABORT(fs, FR_INT_ERR);
+		sect += csect;
+#if FF_FS_TINY
+		if (move_window(fs, sect) != FR_OK) ABORT(fs, FR_DISK_ERR);	/* Move sector window to the file data */
+		dbuf = fs->win;
+#else
+		if (fp->sect != sect) {		/* Fill sector cache with file data */
+#if !FF_FS_READONLY
+			if (fp->flag & FA_DIRTY) {		/* Write-back dirty sector cache */
+				if (disk_write(fs->pdrv, fp->buf, fp->sect, 1) != RES_OK) ABORT(fs, FR_DISK_ERR);
+				fp->flag &= (BYTE)~FA_DIRTY;
+			}
+#endif
+			if (disk_read(fs->pdrv, fp->buf, sect, 1) != RES_OK) ABORT(fs, FR_DISK_ERR);
+		}
+		dbuf = fp->buf;
+#endif
+		fp->sect = sect;
+		rcnt = SS(fs) - (UINT)fp->fptr % SS(fs);	/* Number of bytes remains in the sector */
+		if (rcnt > btf) rcnt = btf;					/* Clip it by btr if needed */
+		rcnt = (*func)(dbuf + ((UINT)fp->fptr % SS(fs)), rcnt);	/* Forward the file data */
+		if (rcnt == 0) ABORT(fs, FR_INT_ERR);
+	}
+
+	LEAVE_FF(fs, FR_OK);
+}
+#endif /* FF_USE_FORWARD */
+
+
+
+#if FF_USE_RECLOG || FF_USE_LOGRING
+/*-----------------------------------------------------------------------*/
+/* Get Sector Size of the Volume (to check parameters prior to open)     */
+/*-----------------------------------------------------------------------*/
+
+static FRESULT vol_ss (
+	const TCHAR* path,	/* Pointer to a path name on the volume */
+	UINT* ss			/* Pointer to return the sector size */
+)
+{
+	FRESULT res;
+	FATFS *fs;
+
+
+	res = mount_volume(&path, &fs, 0);
+	if (res == FR_OK) *ss = SS(fs);
+	LEAVE_FF(fs, res);
+}
+#endif
+
+
+
+#if FF_USE_RECLOG
+/*-----------------------------------------------------------------------*/
+/* Record Log (with sub-functions)                                       */
+/*-----------------------------------------------------------------------*/
+
+/* Get offset of a record in the data file */
+
+static FSIZE_t rlog_ofs (
+	RECLOG* rl,		/* Pointer to the record log */
+	DWORD rn		/* Record number */
+)
+{
+	return (FSIZE_t)(rn / rl->rps) * rl->ss + (FSIZE_t)(rn % rl->rps) * rl->rsz;
+}
+
+
+/* Move file pointer of the data file with the index */
+
+static FRESULT rlog_seek (
+	RECLOG* rl,		/* Pointer to the record log */
+	FSIZE_t ofs		/* File pointer from top of the data file */
+)
+{
+	FIL *fp = &rl->dat;
+	FRESULT res;
+	DWORD ci;
+	UINT br;
+	BYTE buf[4];
+
+
+	if (ofs > 0 && (fp->fptr == 0 || (ofs - 1) / rl->bcs != (fp->fptr - 1) / rl->bcs)) {	/* Not in the current cluster? */
+		ci = (DWORD)((ofs - 1) / rl->bcs);		/* Cluster order of the target */
+		if (ci >= rl->nidx) return FR_INT_ERR;
+		res = f_lseek(&rl->idx, (FSIZE_t)ci * 4);	/* Get the cluster number from the index */
+		if (res == FR_OK) res = f_read(&rl->idx, buf, 4, &br);
+		if (res != FR_OK) return res;
+		if (br != 4) return FR_INT_ERR;
+		fp->fptr = (FSIZE_t)ci * rl->bcs + 1;	/* Put the file pointer into the target cluster, */
+		fp->clust = ld_dword(buf);				/* so that f_lseek() does not follow the FAT chain */
+	}
+	return f_lseek(fp, ofs);
+}
+
+
+/* Add the current cluster of the data file to the index if it is a new one */
+
+static FRESULT rlog_index (
+	RECLOG* rl		/* Pointer to the record log */
+)
+{
+	FRESULT res;
+	UINT bw;
+	BYTE buf[4];
+
+
+	if ((DWORD)((rl->dat.fptr - 1) / rl->bcs) < rl->nidx) return FR_OK;	/* Already in the index? */
+	st_dword(buf, rl->dat.clust);
+	res = f_lseek(&rl->idx, (FSIZE_t)rl->nidx * 4);
+	if (res == FR_OK) res = f_write(&rl->idx, buf, 4, &bw);
+	if (res == FR_OK && bw != 4) res = FR_DENIED;
+	if (res == FR_OK) rl->nidx++;
+	return res;
+}
+
+
+
+FRESULT f_rlog_open (
+	RECLOG* rl,			/* Pointer to the blank record log object */
+	const TCHAR* dpath,	/* Pointer to the data file name */
+	const TCHAR* ipath,	/* Pointer to the index file name */
+	UINT rsz			/* Size of a record [byte] */
+)
+{
+	FRESULT res;
+	FSIZE_t sz, ofs;
+	DWORD n;
+	UINT bw, br;
+	int vi;
+	BYTE buf[4];
+
+
+	if (!rl || rsz == 0) return FR_INVALID_PARAMETER;
+	res = vol_ss(dpath, &rl->ss);
+	if (res != FR_OK) return res;
+	if (rsz > rl->ss) return FR_INVALID_PARAMETER;	/* A record must fit in a sector */
+	res = f_open(&rl->dat, dpath, FA_OPEN_ALWAYS | FA_READ | FA_WRITE);
+	if (res != FR_OK) return res;
+	res = f_open(&rl->idx, ipath, FA_OPEN_ALWAYS | FA_READ | FA_WRITE);
+	if (res != FR_OK) {
+		f_close(&rl->dat);
+		return res;
+	}
+	rl->bcs = (DWORD)rl->dat.obj.fs->csize * rl->ss;
+	rl->rsz = rsz;
+	rl->rps = rl->ss / rsz;
+	sz = f_size(&rl->dat);
+	rl->nrec = (DWORD)(sz / rl->ss) * rl->rps + (UINT)(sz % rl->ss) / rsz;	/* Number of records stored */
+	ofs = rlog_ofs(rl, rl->nrec);
+	if (ofs < sz) {		/* Discard a record left incomplete by power failure */
+		res = f_lseek(&rl->dat, ofs);
+		if (res == FR_OK) res = f_truncate(&rl->dat);
+		sz = ofs;
+	}
+	n = (DWORD)((sz + rl->bcs - 1) / rl->bcs);	/* Number of clusters in the data file */
+	vi = (f_size(&rl->idx) == (FSIZE_t)n * 4);	/* Index can be valid? */
+	if (res == FR_OK) res = f_lseek(&rl->idx, 0);
+	for (rl->nidx = 0; res == FR_OK && rl->nidx < n; rl->nidx++) {	/* Check the index against the FAT chain and rebuild it if not match */
+		ofs = (FSIZE_t)(rl->nidx + 1) * rl->bcs;
+		res = f_lseek(&rl->dat, ofs < sz ? ofs : sz);	/* Go to end of the cluster */
+		if (res != FR_OK) break;
+		if (vi) {
+			res = f_read(&rl->idx, buf, 4, &br);
+			if (res != FR_OK) break;
+			if (br == 4 && ld_dword(buf) == rl->dat.clust) continue;	/* The item is valid */
+			vi = 0;
+			res = f_lseek(&rl->idx, (FSIZE_t)rl->nidx * 4);	/* Rewrite the index from this item */
+			if (res != FR_OK) break;
+		}
+		st_dword(buf, rl->dat.clust);
+		res = f_write(&rl->idx, buf, 4, &bw);
+		if (res == FR_OK && bw != 4) res = FR_DENIED;
+	}
+	if (res == FR_OK && !vi) res = f_truncate(&rl->idx);	/* Remove extra items */
+	rl->nidx = n;
+	if (res == FR_OK) res = rlog_seek(rl, sz);	/* Go to end of the log */
+	if (res != FR_OK) {
+		f_close(&rl->idx);
+		f_close(&rl->dat);
+	}
+	return res;
+}
+
+
+
+FRESULT f_rlog_append (
+	RECLOG* rl,			/* Pointer to the record log */
+	const void* buff,	/* Pointer to the records to be appended */
+	UINT nr				/* Number of records to append */
+)
+{
+	FRESULT res = FR_OK;
+	FIL *fp = &rl->dat;
+	const BYTE *rbuff = (const BYTE*)buff;
+	UINT n, bw;
+
+
+	if (fp->fptr != rlog_ofs(rl, rl->nrec)) res = rlog_seek(rl, rlog_ofs(rl, rl->nrec));	/* Go to end of the log if moved */
+	while (res == FR_OK && nr > 0) {
+		n = rl->rps - (UINT)(rl->nrec % rl->rps);	/* Number of records fit in the current sector */
+		if (n > nr) n = nr;
+		res = f_write(fp, rbuff, n * rl->rsz, &bw);	/* Put the records in the sector */
+		if (res == FR_OK && bw != n * rl->rsz) res = FR_DENIED;	/* Disk full? */
+		if (res != FR_OK) break;
+		res = rlog_index(rl);
+		if (res != FR_OK) break;
+		rbuff += bw; rl->nrec += n; nr -= n;
+		if (rl->nrec % rl->rps == 0 && (UINT)(fp->fptr % rl->ss) != 0) {	/* Skip the gap at end of the sector */
+			res = f_lseek(fp, fp->fptr + rl->ss - (UINT)(fp->fptr % rl->ss));
+		}
+	}
+	return res;
+}
+
+
+
+FRESULT f_rlog_read (
+	RECLOG* rl,			/* Pointer to the record log */
+	DWORD rn,			/* Record number to start to read */
+	void* buff,			/* Pointer to the buffer to store the records */
+	UINT nr,			/* Number of records to read */
+	UINT* rr			/* Pointer to the variable to return number of records read */
+)
+{
+	FRESULT res;
+	FIL *fp = &rl->dat;
+	BYTE *rbuff = (BYTE*)buff;
+	UINT n, br;
+
+
+	*rr = 0;	/* Clear read record counter */
+	if (rn >= rl->nrec) return FR_OK;
+	if (nr > rl->nrec - rn) nr = (UINT)(rl->nrec - rn);	/* Truncate nr by number of records remaining */
+	res = rlog_seek(rl, rlog_ofs(rl, rn));
+	while (res == FR_OK && nr > 0) {
+		n = rl->rps - (UINT)(rn % rl->rps);	/* Number of records left in the sector */
+		if (n > nr) n = nr;
+		res = f_read(fp, rbuff, n * rl->rsz, &br);
+		if (res == FR_OK && br != n * rl->rsz) res = FR_INT_ERR;
+		if (res != FR_OK) break;
+		rbuff += br; rn += n; nr -= n; *rr += n;
+		if (nr > 0 && rn % rl->rps == 0 && (UINT)(fp->fptr % rl->ss) != 0) {	/* Skip the gap at end of the sector */
+			res = f_lseek(fp, fp->fptr + rl->ss - (UINT)(fp->fptr % rl->ss));
+		}
+	}
+	return res;
+}
+
+
+
+FRESULT f_rlog_sync (
+	RECLOG* rl			/* Pointer to the record log */
+)
+{
+	FRESULT res;
+
+
+	res = f_sync(&rl->dat);
+	if (res == FR_OK) res = f_sync(&rl->idx);
+	return res;
+}
+
+
+
+FRESULT f_rlog_close (
+	RECLOG* rl			/* Pointer to the record log */
+)
+{
+	FRESULT res, res2;
+
+
+	res = f_close(&rl->dat);
+	res2 = f_close(&rl->idx);
+	return res != FR_OK ? res : res2;
+}
+
+#endif /* FF_USE_RECLOG */
+
+
+
+#if FF_USE_LOGRING
+/*-----------------------------------------------------------------------*/
+/* Log Ring (with sub-functions)                                         */
+/*-----------------------------------------------------------------------*/
+
+#define SZ_RING_PATH	32			/* Size of the segment file name buffer */
+#define LR_SIGNATURE	0x474E524C	/* Segment header signature "LRNG" */
+#define LR_Sig			0			/* Segment header signature (DWORD) */
+#define LR_Seq			4			/* Sequence number, 0:Not used (DWORD) */
+#define LR_Len			8			/* Data length following the header (DWORD) */
+
+
+/* Load or store the header of the current segment */
+
+static FRESULT ring_header (
+	LOGRING* lr,	/* Pointer to the log ring */
+	DWORD* seq,		/* Sequence number to be read/written */
+	DWORD* len,		/* Data length to be read/written */
+	int wr			/* 0:Read, 1:Write */
+)
+{
+	FRESULT res;
+	FATFS *fs;
+	LBA_t sect;
+
+
+	res = validate(&lr->fil.obj, &fs);	/* Check validity of the segment file object */
+	if (res == FR_OK) {
+		sect = clst2sect(fs, lr->fil.obj.sclust);	/* Top sector of the segment */
+		if (sect == 0) res = FR_INT_ERR;
+	}
+	if (res == FR_OK) {
+		if (wr) {	/* Write the header without reading it */
+			res = sync_window(fs);
+			if (res == FR_OK) {
+				fs->winsect = sect;
+				memset(fs->win, 0, sizeof fs->win);
+				st_dword(fs->win + LR_Sig, LR_SIGNATURE);
+				st_dword(fs->win + LR_Seq, *seq);
+				st_dword(fs->win + LR_Len, *len);
+				fs->wflag = 1;
+				res = sync_window(fs);
+			}
+			if (res == FR_OK && disk_ioctl(fs->pdrv, CTRL_SYNC, 0) != RES_OK) res = FR_DISK_ERR;	/* Make sure it is on the media */
+		} else {	/* Read the header */
+			res = move_window(fs, sect);
+			if (res == FR_OK) {
+				*seq = *len = 0;
+				if (ld_dword(fs->win + LR_Sig) == LR_SIGNATURE) {	/* Is it a valid segment? */
+					*seq = ld_dword(fs->win + LR_Seq);
+					*len = ld_dword(fs->win + LR_Len);
+				}
+			}
+		}
+	}
+	LEAVE_FF(fs, res);
+}
+
+
+/* Open a segment file and create it if not prepared */
+
+static FRESULT ring_open_seg (
+	LOGRING* lr,	/* Pointer to the log ring */
+	UINT sn			/* Segment number */
+)
+{
+	FRESULT res;
+	FIL *fp = &lr->fil;
+	TCHAR nbuf[SZ_RING_PATH];
+	DWORD z = 0;
+	UINT i;
+	int mk;
+
+
+	for (i = 0; (nbuf[i] = lr->pat[i]) != 0; i++) ;	/* Make the segment file name */
+	while (i-- > 0) {
+		if (nbuf[i] == '#') {
+			nbuf[i] = (TCHAR)('0' + sn % 10); sn /= 10;
+		}
+	}
+	res = f_open(fp, nbuf, FA_OPEN_ALWAYS | FA_READ | FA_WRITE);
+	if (res != FR_OK) return res;
+	lr->hsz = SS(fp->obj.fs);
+	mk = (f_size(fp) != lr->ssz);	/* Not a segment file? */
+#if FF_USE_FASTSEEK
+	if (res == FR_OK && !mk) {	/* Check if the segment is contiguous */
+		lr->clmt[0] = 4; fp->cltbl = lr->clmt;
+		res = f_lseek(fp, CREATE_LINKMAP);
+		if (res == FR_NOT_ENOUGH_CORE) {	/* Fragmented? */
+			fp->cltbl = 0;			/* Recreate it (the chain is removed by f_truncate) */
+			res = FR_OK; mk = 1;
+		}
+	}
+#endif
+	if (res == FR_OK && mk) {
+		res = f_lseek(fp, 0);
+		if (res == FR_OK) res = f_truncate(fp);
+		if (res == FR_OK) res = f_expand(fp, lr->ssz, 1);	/* Allocate contiguous clusters */
+		if (res == FR_OK) res = ring_header(lr, &z, &z, 1);	/* Put a blank header */
+#if FF_USE_FASTSEEK
+		if (res == FR_OK) {
+			lr->clmt[0] = 4; fp->cltbl = lr->clmt;
+			res = f_lseek(fp, CREATE_LINKMAP);
+		}
+#endif
+	}
+	if (res != FR_OK) f_close(fp);
+	return res;
+}
+
+
+/* Switch to the next segment and discard its old data */
+
+static FRESULT ring_next (
+	LOGRING* lr		/* Pointer to the log ring */
+)
+{
+	FRESULT res;
+
+
+	res = f_ring_sync(lr);	/* Finalize the current segment */
+	if (res == FR_OK) res = f_close(&lr->fil);
+	if (res != FR_OK) return res;
+	lr->cur = (lr->cur + 1) % lr->nseg;
+	lr->seq++; lr->len = 0;
+	res = ring_open_seg(lr, lr->cur);
+	if (res == FR_OK) res = ring_header(lr, &lr->seq, &lr->len, 1);	/* Make it the newest segment */
+	if (res == FR_OK) res = f_lseek(&lr->fil, lr->hsz);
+	return res;
+}
+
+
+
+FRESULT f_ring_open (
+	LOGRING* lr,		/* Pointer to the blank log ring object */
+	const TCHAR* pat,	/* Pointer to the segment file name pattern (e.g. "LOG###.TXT") */
+	UINT nseg,			/* Number of segments in the ring */
+	FSIZE_t ssz			/* Size of a segment file [byte] */
+)
+{
+	FRESULT res = FR_OK;
+	DWORD seq, len, n;
+	UINT i;
+
+
+	if (!lr || !pat) return FR_INVALID_PARAMETER;
+	for (i = 0, n = 1; pat[i]; i++) {	/* Get the number of segments the pattern can name */
+		if (pat[i] == '#' && n < 100000) n *= 10;
+	}
+	if (nseg == 0 || n == 1 || nseg > n || i >= SZ_RING_PATH) return FR_INVALID_PARAMETER;
+	res = vol_ss(pat, &i);
+	if (res != FR_OK) return res;
+	if (ssz < (FSIZE_t)i * 2) return FR_INVALID_PARAMETER;	/* Too small to hold the header and data */
+	lr->pat = pat; lr->nseg = nseg; lr->ssz = ssz;
+	lr->seq = lr->len = 0; lr->cur = 0;
+
+	for (i = 0; res == FR_OK && i < nseg; i++) {	/* Prepare all segments and find the newest one */
+		res = ring_open_seg(lr, i);
+		if (res != FR_OK) break;
+		res = ring_header(lr, &seq, &len, 0);
+		if (res == FR_OK && seq > lr->seq && len <= ssz - lr->hsz) {
+			lr->seq = seq; lr->len = len; lr->cur = i;
+		}
+		f_close(&lr->fil);
+	}
+	if (res == FR_OK) res = ring_open_seg(lr, lr->cur);
+	if (res == FR_OK && lr->seq == 0) {		/* Blank ring? */
+		lr->seq = 1;
+		res = ring_header(lr, &lr->seq, &lr->len, 1);
+	}
+	if (res == FR_OK) {
+		res = f_lseek(&lr->fil, lr->hsz + lr->len);	/* Go to end of the log */
+		if (res != FR_OK) f_close(&lr->fil);
+	}
+	return res;
+}
+
+
+
+FRESULT f_ring_write (
+	LOGRING* lr,		/* Pointer to the log ring */
+	const void* buff,	/* Pointer to the data to be written */
+	UINT btw,			/* Number of bytes to write (not split into segments) */
+	UINT* bw			/* Pointer to the variable to return number of bytes written */
+)
+{
+	FRESULT res = FR_OK;
+	FIL *fp = &lr->fil;
+
+
+	*bw = 0;	/* Clear write byte counter */
+	if ((FSIZE_t)btw > lr->ssz - lr->hsz) return FR_INVALID_PARAMETER;	/* Never fits in a segment */
+	if ((FSIZE_t)btw > lr->ssz - f_tell(fp)) res = ring_next(lr);	/* Go to the next segment if not fit */
+	if (res == FR_OK) {
+		if (!FF_FS_EXFAT || fp->obj.fs->fs_type != FS_EXFAT) {	/* The contiguous chain of exFAT is bounded by the size */
+			fp->obj.objsize = f_tell(fp);	/* Data following the log is garbage, so that f_write() does not read the sector to be filled */
+		}
+		res = f_write(fp, buff, btw, bw);
+		fp->obj.objsize = lr->ssz;	/* Restore the segment size */
+	}
+	return res;
+}
+
+
+
+FRESULT f_ring_sync (
+	LOGRING* lr			/* Pointer to the log ring */
+)
+{
+	FRESULT res;
+	DWORD len;
+
+
+	res = f_sync(&lr->fil);		/* Flush the data first */
+	len = (DWORD)(f_tell(&lr->fil) - lr->hsz);
+	if (res == FR_OK && len != lr->len) {	/* Update the header if the data length has been changed */
+		res = ring_header(lr, &lr->seq, &len, 1);
+		if (res == FR_OK) lr->len = len;
+	}
+	return res;
+}
+
+
+
+FRESULT f_ring_close (
+	LOGRING* lr			/* Pointer to the log ring */
+)
+{
+	FRESULT res, res2;
+
+
+	res = f_ring_sync(lr);
+	res2 = f_close(&lr->fil);
+	return res != FR_OK ? res : res2;
+}
+
+#endif /* FF_USE_LOGRING */
+
+
+
+#if FF_USE_JOURNAL
+/*-----------------------------------------------------------------------*/
+/* Append Journal (with sub-functions)                                   */
+/*-----------------------------------------------------------------------*/
+
+#define SZ_JNL_BUF	32		/* Size of the replay buffer */
+#define JE_SIG		0x4E4A	/* Signature of entry "JN" */
+#define JH_SIG		0x484A	/* Signature of header "JH" */
+#define JE_Sig		0		/* Signature (WORD) */
+#define JE_Len		2		/* Data length (WORD) */
+#define JE_Seq		4		/* Sequence number of the entry (DWORD) */
+#define JE_Ofs		8		/* File offset of the data, or sequence number at the last checkpoint in the header (DWORD) */
+#define JE_Sum		12		/* Checksum of the entry (DWORD) */
+#define SZ_JE		16		/* Size of the entry header (data follows it) */
+
+
+static DWORD jnl_sum (	/* Returns 32-bit checksum */
+	const BYTE* dat,	/* Pointer to the data */
+	UINT n,				/* Number of bytes */
+	DWORD sum			/* Sum to be continued */
+)
+{
+	while (n--) sum = ((sum & 1) ? 0x80000000 : 0) + (sum >> 1) + *dat++;
+	return sum;
+}
+
+
+/* Locate the journal file and check if it is contiguous */
+
+static FRESULT jnl_locate (
+	JOURNAL* jn		/* Pointer to the journal */
+)
+{
+	FRESULT res;
+	FATFS *fs;
+	DWORD clst, ncl;
+
+
+	res = validate(&jn->fil.obj, &fs);
+	if (res == FR_OK) {
+		jn->sect = clst2sect(fs, jn->fil.obj.sclust);
+		if (jn->sect == 0) res = FR_INT_ERR;
+	}
+	if (res == FR_OK && jn->fil.obj.stat != 2) {	/* Check if the FAT chain is contiguous */
+		ncl = (DWORD)((jn->fil.obj.objsize - 1) / ((DWORD)fs->csize * SS(fs)));
+		for (clst = jn->fil.obj.sclust; res == FR_OK && ncl > 0; clst++, ncl--) {
+			if (get_fat(&jn->fil.obj, clst) != clst + 1) res = FR_NOT_ENOUGH_CORE;
+		}
+	}
+	LEAVE_FF(fs, res);
+}
+
+
+/* Write an entry or the header to the journal */
+
+static FRESULT jnl_put (
+	JOURNAL* jn,		/* Pointer to the journal */
+	DWORD sn,			/* Sector offset in the journal (0:Header) */
+	WORD sig,			/* Signature */
+	DWORD seq,			/* Sequence number */
+	DWORD ofs,			/* File offset of the data */
+	const BYTE* dat,	/* Pointer to the data */
+	UINT len			/* Data length */
+)
+{
+	FRESULT res;
+	FATFS *fs;
+
+
+	res = validate(&jn->fil.obj, &fs);
+	if (res == FR_OK) res = sync_window(fs);	/* Use the window as sector buffer */
+	if (res == FR_OK) {
+		fs->winsect = jn->sect + sn;
+		memset(fs->win, 0, sizeof fs->win);
+		st_word(fs->win + JE_Sig, sig);
+		st_word(fs->win + JE_Len, (WORD)len);
+		st_dword(fs->win + JE_Seq, seq);
+		st_dword(fs->win + JE_Ofs, ofs);
+		if (len) memcpy(fs->win + SZ_JE, dat, len);
+		st_dword(fs->win + JE_Sum, jnl_sum(fs->win, SZ_JE + len, 0));
+		fs->wflag = 1;
+		res = sync_window(fs);
+		if (res == FR_OK && disk_ioctl(fs->pdrv, CTRL_SYNC, 0) != RES_OK) res = FR_DISK_ERR;	/* Make sure it is on the media */
+	}
+	LEAVE_FF(fs, res);
+}
+
+
+/* Check an entry or the header in the journal and read its data */
+
+static FRESULT jnl_get (
+	JOURNAL* jn,		/* Pointer to the journal */
+	DWORD sn,			/* Sector offset in the journal (0:Header) */
+	WORD sig,			/* Signature to be matched */
+	DWORD seq,			/* Sequence number to be matched (not checked for header) */
+	DWORD* ofs,			/* Pointer to return the file offset (0xFFFFFFFF:Invalid entry) */
+	UINT* len,			/* Pointer to return the data length */
+	BYTE* buf,			/* Pointer to the buffer to read the data (null:Check only) */
+	UINT bofs,			/* Offset in the data to read */
+	UINT btr			/* Number of bytes to read */
+)
+{
+	FRESULT res;
+	FATFS *fs;
+	DWORD sum;
+	UINT n;
+
+
+	res = validate(&jn->fil.obj, &fs);
+	if (res == FR_OK) res = move_window(fs, jn->sect + sn);
+	if (res == FR_OK) {
+		*ofs = 0xFFFFFFFF; *len = 0;
+		n = ld_word(fs->win + JE_Len);
+		if (ld_word(fs->win + JE_Sig) == sig && n <= (UINT)(SS(fs) - SZ_JE) && (sn == 0 || ld_dword(fs->win + JE_Seq) == seq)) {
+			sum = ld_dword(fs->win + JE_Sum);
+			st_dword(fs->win + JE_Sum, 0);
+			if (jnl_sum(fs->win, SZ_JE + n, 0) == sum) {	/* Valid entry? */
+				*ofs = ld_dword(fs->win + JE_Ofs); *len = n;
+				if (buf) memcpy(buf, fs->win + SZ_JE + bofs, btr);
+			}
+			st_dword(fs->win + JE_Sum, sum);
+		}
+	}
+	LEAVE_FF(fs, res);
+}
+
+
+
+FRESULT f_jnl_open (
+	JOURNAL* jn,		/* Pointer to the blank journal object */
+	FIL* fp,			/* Pointer to the file opened in write mode */
+	const TCHAR* path,	/* Pointer to the journal file name */
+	UINT nslot			/* Number of entries the journal can hold */
+)
+{
+	FRESULT res;
+	DWORD ofs;
+	UINT len, i, n, bw;
+	BYTE buf[SZ_JNL_BUF];
+
+
+	if (!jn || nslot == 0) return FR_INVALID_PARAMETER;
+	jn->fp = fp; jn->nslot = nslot;
+	for (;;) {
+		res = f_open(&jn->fil, path, FA_OPEN_ALWAYS | FA_READ | FA_WRITE);
+		if (res != FR_OK) return res;
+		if (f_size(&jn->fil) != (FSIZE_t)(nslot + 1) * SS(jn->fil.obj.fs)) {	/* Not a journal of this size? */
+			res = f_truncate(&jn->fil);
+			if (res == FR_OK) res = f_expand(&jn->fil, (FSIZE_t)(nslot + 1) * SS(jn->fil.obj.fs), 1);	/* Allocate contiguous sectors */
+		}
+		if (res == FR_OK) res = f_sync(&jn->fil);
+		if (res == FR_OK) res = jnl_locate(jn);
+		if (res != FR_NOT_ENOUGH_CORE) break;
+		res = f_close(&jn->fil);	/* Fragmented journal cannot be used */
+		if (res == FR_OK) res = f_unlink(path);	/* Remove it and create it again */
+		if (res != FR_OK) return res;
+	}
+	if (res != FR_OK) {
+		f_close(&jn->fil);
+		return res;
+	}
+
+	res = jnl_get(jn, 0, JH_SIG, 0, &ofs, &len, 0, 0, 0);	/* Load the header */
+	if (res == FR_OK && ofs == 0xFFFFFFFF) {	/* Blank journal */
+		jn->seq = jn->cseq = 0;
+		res = jnl_put(jn, 0, JH_SIG, 0, 0, 0, 0);
+		if (res != FR_OK) f_close(&jn->fil);
+		return res;
+	}
+	jn->cseq = jn->seq = ofs;	/* Sequence number at the last checkpoint */
+
+	while (res == FR_OK) {	/* Replay the entries following the checkpoint */
+		if (jn->seq - jn->cseq >= jn->nslot) break;
+		res = jnl_get(jn, 1 + jn->seq % jn->nslot, JE_SIG, jn->seq, &ofs, &len, 0, 0, 0);
+		if (res != FR_OK || ofs == 0xFFFFFFFF) break;
+		res = f_lseek(fp, ofs);
+		for (i = 0; res == FR_OK && i < len; i += n) {	/* Put the data back to the file */
+			n = len - i;
+			if (n > SZ_JNL_BUF) n = SZ_JNL_BUF;
+			res = jnl_get(jn, 1 + jn->seq % jn->nslot, JE_SIG, jn->seq, &ofs, &len, buf, i, n);
+			if (res == FR_OK) res = f_write(fp, buf, n, &bw);
+			if (res == FR_OK && bw != n) res = FR_DENIED;
+		}
+		if (res != FR_OK) break;
+		jn->seq++;
+	}
+	if (res == FR_OK && jn->seq != jn->cseq) {	/* Some entries have been replayed? */
+		res = f_lseek(fp, f_size(fp));
+		if (res == FR_OK) res = f_jnl_checkpoint(jn);
+	}
+	if (res != FR_OK) f_close(&jn->fil);
+	return res;
+}
+
+
+
+FRESULT f_jnl_write (
+	JOURNAL* jn,		/* Pointer to the journal */
+	const void* buff,	/* Pointer to the data to be written */
+	UINT btw,			/* Number of bytes to write */
+	UINT* bw			/* Pointer to the variable to return number of bytes written */
+)
+{
+	FRESULT res = FR_OK;
+	const BYTE *wbuff = (const BYTE*)buff;
+	DWORD ofs;
+	UINT n, wc;
+
+
+	*bw = 0;	/* Clear write byte counter */
+	while (res == FR_OK && btw > 0) {
+		if (jn->seq - jn->cseq >= jn->nslot) {	/* Journal is full? */
+			res = f_jnl_checkpoint(jn);
+			if (res != FR_OK) break;
+		}
+		n = SS(jn->fil.obj.fs) - SZ_JE;		/* Data size an entry can hold */
+		if (n > btw) n = btw;
+		ofs = (DWORD)f_tell(jn->fp);
+		res = f_write(jn->fp, wbuff, n, &wc);	/* Write the data to the file */
+		if (res == FR_OK && wc != n) res = FR_DENIED;	/* Disk full? */
+		if (res == FR_OK) res = jnl_put(jn, 1 + jn->seq % jn->nslot, JE_SIG, jn->seq, ofs, wbuff, n);	/* Record it in the journal */
+		if (res != FR_OK) break;
+		jn->seq++;
+		wbuff += n; btw -= n; *bw += n;
+	}
+	return res;
+}
+
+
+
+FRESULT f_jnl_checkpoint (
+	JOURNAL* jn			/* Pointer to the journal */
+)
+{
+	FRESULT res;
+
+
+	res = f_sync(jn->fp);	/* Save the file */
+	if (res == FR_OK && jn->seq != jn->cseq) {
+		res = jnl_put(jn, 0, JH_SIG, 0, jn->seq, 0, 0);	/* Discard the entries saved in the file */
+		if (res == FR_OK) jn->cseq = jn->seq;
+	}
+	return res;
+}
+
+
+
+FRESULT f_jnl_close (
+	JOURNAL* jn			/* Pointer to the journal */
+)
+{
+	FRESULT res;
+
+
+	res = f_jnl_checkpoint(jn);
+	if (res == FR_OK) res = f_close(&jn->fil);	/* Close the journal file (invalidates the journal object) */
+	return res;
+}
+
+#endif /* FF_USE_JOURNAL */
+
+
+
+#if FF_USE_DIRSCAN
+/*-----------------------------------------------------------------------*/
+/* Bulk Directory Scan                                                   */
+/*-----------------------------------------------------------------------*/
+
+static FRESULT dirscan_load (	/* Set dp->dir to the current entry in the sector buffer */
+	DIRSCAN* ds				/* Pointer to the directory scan object */
+)
+{
+	DIR *dp = &ds->dir;
+	FATFS *fs = dp->obj.fs;
+	UINT n;
+
+
+	if (dp->sect - ds->bsect >= ds->nload) {	/* Current sector is not in the buffer? */
+		if (dp->clust == 0) {	/* Static table: up to end of the table */
+			n = (UINT)(fs->dirbase + fs->n_rootdir / (SS(fs) / SZDIRE) - dp->sect);
+		} else {				/* Dynamic table: up to end of the cluster */
+			n = fs->csize - (UINT)(dp->sect - clst2sect(fs, dp->clust));
+		}
+		if (n > ds->nbuf) n = ds->nbuf;
+		ds->nload = 0;
+		if (disk_read(fs->pdrv, ds->buf, dp->sect, n) != RES_OK) return FR_DISK_ERR;
+		ds->bsect = dp->sect; ds->nload = n;
+		if (fs->winsect - dp->sect < n) {	/* Replace the sector in the window, it can be newer than the disk */
+			memcpy(ds->buf + (UINT)(fs->winsect - dp->sect) * SS(fs), fs->win, SS(fs));
+		}
+	}
+	dp->dir = ds->buf + (UINT)(dp->sect - ds->bsect) * SS(fs) + dp->dptr % SS(fs);
+	return FR_OK;
+}
+
+
+FRESULT f_dirscan_open (
+	DIRSCAN* ds,		/* Pointer to the blank directory scan object */
+	const TCHAR* path,	/* Pointer to the directory path */
+	void* buff,			/* Pointer to the sector buffer */
+	UINT btb			/* Size of the sector buffer [byte] */
+)
+{
+	FRESULT res;
+
+
+	if (!ds || !buff) return FR_INVALID_PARAMETER;
+	res = f_opendir(&ds->dir, path);
+	if (res == FR_OK) {
+		ds->buf = (BYTE*)buff;
+		ds->nbuf = btb / SS(ds->dir.obj.fs);
+		ds->nload = 0; ds->bsect = 0;
+		if (ds->nbuf == 0) {	/* The buffer needs at least a sector */
+			f_closedir(&ds->dir);
+			res = FR_INVALID_PARAMETER;
+		}
+	}
+	return res;
+}
+
+
+FRESULT f_dirscan_read (
+	DIRSCAN* ds,		/* Pointer to the directory scan object */
+	FILINFO* fno		/* Pointer to file information to return (fname[0] == 0 at end of the directory) */
+)
+{
+	FRESULT res;
+	FATFS *fs;
+	DIR *dp = &ds->dir;
+	BYTE attr, b;
+#if FF_USE_LFN
+	BYTE ord = 0xFF, sum = 0xFF;
+#endif
+	DEF_NAMBUF
+
+
+	if (!fno) return FR_INVALID_PARAMETER;
+	res = validate(&dp->obj, &fs);	/* Check validity of the directory object */
+	if (res == FR_OK) {
+		INIT_NAMBUF(fs);
+#if FF_FS_EXFAT
+		if (fs->fs_type == FS_EXFAT) {	/* No bulk read on the exFAT volume */
+			res = DIR_READ_FILE(dp);
+		} else
+#endif
+		{
+			res = FR_NO_FILE;
+			while (dp->sect) {	/* Read an item in the same way as dir_read() */
+				res = dirscan_load(ds);
+				if (res != FR_OK) break;
+				b = dp->dir[DIR_Name];	/* Test for the entry type */
+				if (b == 0) {
+					res = FR_NO_FILE; break;	/* Reached to end of the directory */
 				}
-			}
-			fs->wflag = 1;
-			res = sync_fs(fs);
-		} else {			/* No volume label entry or an error */
-			if (res == FR_NO_FILE) {
-				res = FR_OK;
-				if (di != 0) {	/* Create a volume label entry */
-					res = dir_alloc(&dj, 1);	/* Allocate an entry */
-					if (res == FR_OK) {
-						memset(dj.dir, 0, SZDIRE);	/* Clean the entry */
-						if (FF_FS_EXFAT && fs->fs_type == FS_EXFAT) {
-							dj.dir[XDIR_Type] = ET_VLABEL;	/* Create volume label entry */
-							dj.dir[XDIR_NumLabel] = (BYTE)di;
-							memcpy(dj.dir + XDIR_Label, dirvn, 22);
-						} else {
-							dj.dir[DIR_Attr] = AM_VOL;		/* Create volume label entry */
-							memcpy(dj.dir, dirvn, 11);
+				dp->obj.attr = attr = dp->dir[DIR_Attr] & AM_MASK;	/* Get attribute */
+#if FF_USE_LFN
+				if (b == DDEM || b == '.' || (attr & ~AM_ARC) == AM_VOL) {	/* An entry without valid data */
+					ord = 0xFF;
+				} else {
+					if (attr == AM_LFN) {	/* An LFN entry is found */
+						if (b & LLEF) {		/* Is it start of an LFN sequence? */
+							sum = dp->dir[LDIR_Chksum];
+							b &= (BYTE)~LLEF; ord = b;
+							dp->blk_ofs = dp->dptr;
 						}
-						fs->wflag = 1;
-						res = sync_fs(fs);
+						ord = (b == ord && sum == dp->dir[LDIR_Chksum] && pick_lfn(fs->lfnbuf, dp->dir)) ? ord - 1 : 0xFF;
+					} else {				/* An SFN entry is found */
+						if (ord != 0 || sum != sum_sfn(dp->dir)) {	/* Is there a valid LFN? */
+							dp->blk_ofs = 0xFFFFFFFF;	/* It has no LFN. */
+						}
+						break;
 					}
 				}
+#else
+				if (b != DDEM && b != '.' && attr != AM_LFN && (attr & ~AM_ARC) != AM_VOL) {	/* Is it a valid entry? */
+					break;
+				}
+#endif
+				res = dir_next(dp, 0);		/* Next entry */
+				if (res != FR_OK) break;
 			}
+			if (res != FR_OK) dp->sect = 0;	/* Terminate the read operation on error or EOT */
+		}
+		if (res == FR_NO_FILE) res = FR_OK;	/* Ignore end of directory */
+		if (res == FR_OK) {				/* A valid entry is found */
+			get_fileinfo(dp, fno);		/* Get the object information (fname[0] = 0 at end of the directory) */
+			res = dir_next(dp, 0);		/* Increment index for next */
+			if (res == FR_NO_FILE) res = FR_OK;	/* Ignore end of directory now */
 		}
+		FREE_NAMBUF();
 	}
-
 	LEAVE_FF(fs, res);
 }
 
-#endif /* !FF_FS_READONLY */
-#endif /* FF_USE_LABEL */
 
+FRESULT f_dirscan_close (
+	DIRSCAN* ds			/* Pointer to the directory scan object */
+)
+{
+	return f_closedir(&ds->dir);
+}
 
+#endif /* FF_USE_DIRSCAN */
 
-#if FF_USE_EXPAND && !FF_FS_READONLY
+
+
+#if FF_USE_DIRINDEX
 /*-----------------------------------------------------------------------*/
-/* Allocate a Contiguous Blocks to the File                              */
+/* Directory Index                                                       */
 /*-----------------------------------------------------------------------*/
 
-FRESULT f_expand (
-	FIL* fp,		/* Pointer to the file object */
-	FSIZE_t fsz,	/* File size to be expanded to */
-	BYTE opt		/* Operation mode 0:Find and prepare or 1:Find and allocate */
+static FRESULT didx_build (	/* Rebuild the index from the directory */
+	FATFS* fs,				/* Filesystem object */
+	FFDIDX* ip				/* Index item to be rebuilt */
 )
 {
 	FRESULT res;
-	FATFS *fs;
-	DWORD n, clst, stcl, scl, ncl, tcl, lclst;
-
+	DIR dj;
+	LBA_t sect, nsect;
+	BYTE c;
 
-	res = validate(&fp->obj, &fs);		/* Check validity of the file object */
-	if (res != FR_OK || (res = (FRESULT)fp->err) != FR_OK) LEAVE_FF(fs, res);
-	if (fsz == 0 || fp->obj.objsize != 0 || !(fp->flag & FA_WRITE)) LEAVE_FF(fs, FR_DENIED);
-#if FF_FS_EXFAT
-	if (fs->fs_type != FS_EXFAT && fsz >= 0x100000000) LEAVE_FF(fs, FR_DENIED);	/* Check if in size limit */
-#endif
-	n = (DWORD)fs->csize * SS(fs);	/* Cluster size */
-	tcl = (DWORD)(fsz / n) + ((fsz & (n - 1)) ? 1 : 0);	/* Number of clusters required */
-	stcl = fs->last_clst; lclst = 0;
-	if (stcl < 2 || stcl >= fs->n_fatent) stcl = 2;
 
-#if FF_FS_EXFAT
-	if (fs->fs_type == FS_EXFAT) {
-		scl = find_bitmap(fs, stcl, tcl);			/* Find a contiguous cluster block */
-		if (scl == 0) res = FR_DENIED;				/* No contiguous cluster block was found */
-		if (scl == 0xFFFFFFFF) res = FR_DISK_ERR;
-		if (res == FR_OK) {	/* A contiguous free area is found */
-			if (opt) {		/* Allocate it now */
-				res = change_bitmap(fs, scl, tcl, 1);	/* Mark the cluster block 'in use' */
-				lclst = scl + tcl - 1;
-			} else {		/* Set it as suggested point for next allocation */
-				lclst = scl - 1;
-			}
-		}
-	} else
+	res = sync_window(fs);		/* Clear the slots */
+	nsect = ((LBA_t)ip->nslot * SZ_DISLOT + SS(fs) - 1) / SS(fs);
+	sect = ip->sect + 1;
+	if (res == FR_OK) {
+		fs->winsect = sect;
+		memset(fs->win, 0, sizeof fs->win);
+#if FF_USE_ZEROFILL
+		if (!disk_zero(fs->pdrv, sect, nsect))
 #endif
-	{
-		scl = clst = stcl; ncl = 0;
-		for (;;) {	/* Find a contiguous cluster block */
-			n = get_fat(&fp->obj, clst);
-			if (++clst >= fs->n_fatent) clst = 2;
-			if (n == 1) {
-				res = FR_INT_ERR; break;
-			}
-			if (n == 0xFFFFFFFF) {
+		for ( ; sect < ip->sect + 1 + nsect; sect++) {
+			if (disk_write(fs->pdrv, fs->win, sect, 1) != RES_OK) {
 				res = FR_DISK_ERR; break;
 			}
-			if (n == 0) {	/* Is it a free cluster? */
-				if (++ncl == tcl) break;	/* Break if a contiguous cluster block is found */
-			} else {
-				scl = clst; ncl = 0;		/* Not a free cluster */
-			}
-			if (clst == stcl) {		/* No contiguous cluster? */
-				res = FR_DENIED; break;
-			}
 		}
-		if (res == FR_OK) {	/* A contiguous free area is found */
-			if (opt) {		/* Allocate it now */
-				for (clst = scl, n = tcl; n; clst++, n--) {	/* Create a cluster chain on the FAT */
-					res = put_fat(fs, clst, (n == 1) ? 0xFFFFFFFF : clst + 1);
-					if (res != FR_OK) break;
-					lclst = clst;
-				}
-			} else {		/* Set it as suggested point for next allocation */
-				lclst = scl - 1;
-			}
+	}
+
+	dj.obj.fs = fs; dj.obj.sclust = ip->dclust;	/* Put all entries of the directory into the index */
+	if (res == FR_OK) res = dir_sdi(&dj, 0);
+	while (res == FR_OK) {
+		res = move_window(fs, dj.sect);
+		if (res != FR_OK) break;
+		c = dj.dir[DIR_Name];
+		if (c == 0) break;		/* End of the directory */
+		if (c != DDEM && !(dj.dir[DIR_Attr] & AM_VOL)) {
+			res = didx_update(&dj, didx_hash(dj.dir), 1);
 		}
+		if (res == FR_OK) res = dir_next(&dj, 0);
 	}
+	if (res == FR_NO_FILE) res = FR_OK;
+	return res;
+}
 
+
+static FRESULT didx_attach (
+	FFOBJID* obj,			/* Object identifier of the index file */
+	DWORD dcl,				/* Start cluster of the directory */
+	UINT nslot				/* Number of slots */
+)
+{
+	FRESULT res;
+	FATFS *fs;
+	FFDIDX *ip = 0;
+	DWORD clst, ncl;
+	LBA_t sect = 0;
+	UINT i;
+
+
+	res = validate(obj, &fs);
+	if (res == FR_OK && obj->stat != 2) {	/* Check if the FAT chain is contiguous */
+		ncl = (DWORD)((obj->objsize - 1) / ((DWORD)fs->csize * SS(fs)));
+		for (clst = obj->sclust; res == FR_OK && ncl > 0; clst++, ncl--) {
+			if (get_fat(obj, clst) != clst + 1) res = FR_DENIED;
+		}
+	}
 	if (res == FR_OK) {
-		fs->last_clst = lclst;		/* Set suggested start cluster to start next */
-		if (opt) {	/* Is it allocated now? */
-			fp->obj.sclust = scl;		/* Update object allocation information */
-			fp->obj.objsize = fsz;
-			if (FF_FS_EXFAT) fp->obj.stat = 2;	/* Set status 'contiguous chain' */
-			fp->flag |= FA_MODIFIED;
-			if (fs->free_clst <= fs->n_fatent - 2) {	/* Update FSINFO */
-				fs->free_clst -= tcl;
-				fs->fsi_flag |= 1;
-			}
+		ip = didx_get(fs, dcl);		/* Find the item of the directory or a blank item */
+		for (i = 0; !ip && i < FF_USE_DIRINDEX; i++) {
+			if (fs->didx[i].sect == 0) ip = &fs->didx[i];
 		}
+		if (!ip) res = FR_TOO_MANY_OPEN_FILES;
 	}
-
+	if (res == FR_OK) {
+		sect = clst2sect(fs, obj->sclust);
+		if (sect == 0) res = FR_INT_ERR;
+	}
+	if (res == FR_OK) {	/* Always rebuild the index because the directory can be changed while it is detached */
+		ip->dclust = dcl; ip->sect = sect; ip->nslot = nslot;
+		res = didx_build(fs, ip);
+		if (res == FR_OK && ip->sect == 0) res = FR_NOT_ENOUGH_CORE;	/* Too many entries for the index */
+	}
+	if (res == FR_OK) res = move_window(fs, sect);
+	if (res == FR_OK) {			/* Mark the index attached before any change of the directory */
+		memset(fs->win, 0, SS(fs));
+		st_dword(fs->win + DI_Sig, DI_SIGNATURE);
+		st_dword(fs->win + DI_Clust, dcl);
+		st_dword(fs->win + DI_NSlot, nslot);
+		fs->win[DI_State] = 1;
+		fs->wflag = 1;
+		res = sync_window(fs);
+		if (res == FR_OK && disk_ioctl(fs->pdrv, CTRL_SYNC, 0) != RES_OK) res = FR_DISK_ERR;
+	}
+	if (res != FR_OK && ip) ip->sect = 0;
 	LEAVE_FF(fs, res);
 }
 
-#endif /* FF_USE_EXPAND && !FF_FS_READONLY */
 
+FRESULT f_diridx_attach (
+	FIL* fp,			/* Pointer to the blank file object (work area used during the function) */
+	const TCHAR* dpath,	/* Pointer to the directory path */
+	const TCHAR* ipath,	/* Pointer to the index file name */
+	UINT nslot			/* Number of slots in the index (twice the number of entries or more is recommended) */
+)
+{
+	FRESULT res;
+	DIR dj;
+	FFOBJID obj;
+	DWORD dcl;
+	FSIZE_t sz;
 
 
-#if FF_USE_FORWARD
-/*-----------------------------------------------------------------------*/
-/* Forward Data to the Stream Directly                                   */
-/*-----------------------------------------------------------------------*/
+	if (!fp || nslot == 0) return FR_INVALID_PARAMETER;
+	res = f_opendir(&dj, dpath);	/* Get start cluster of the directory */
+	if (res != FR_OK) return res;
+	dcl = dj.obj.sclust;
+	f_closedir(&dj);
+	for (;;) {
+		res = f_open(fp, ipath, FA_OPEN_ALWAYS | FA_READ | FA_WRITE);
+		if (res != FR_OK) break;
+		sz = (FSIZE_t)(1 + ((DWORD)nslot * SZ_DISLOT + SS(fp->obj.fs) - 1) / SS(fp->obj.fs)) * SS(fp->obj.fs);
+		if (f_size(fp) != sz) {		/* Not an index of this size? */
+			res = f_truncate(fp);
+			if (res == FR_OK) res = f_expand(fp, sz, 1);	/* Allocate contiguous sectors */
+		}
+		obj = fp->obj;		/* The index is accessed by sector without the file object */
+		if (res == FR_OK) res = f_close(fp);
+		if (res != FR_OK) {
+			f_close(fp);
+			break;
+		}
+		res = didx_attach(&obj, dcl, nslot);
+		if (res != FR_DENIED) break;
+		res = f_unlink(ipath);	/* Fragmented index cannot be used, remove it and create it again */
+		if (res != FR_OK) break;
+	}
+	return res;
+}
 
-FRESULT f_forward (
-	FIL* fp, 						/* Pointer to the file object */
-	UINT (*func)(const BYTE*,UINT),	/* Pointer to the streaming function */
-	UINT btf,						/* Number of bytes to forward */
-	UINT* bf						/* Pointer to number of bytes forwarded */
+
+FRESULT f_diridx_detach (
+	const TCHAR* dpath	/* Pointer to the directory path */
 )
 {
 	FRESULT res;
 	FATFS *fs;
-	DWORD clst;
-	LBA_t sect;
-	FSIZE_t remain;
-	UINT rcnt, csect;
-	BYTE *dbuf;
-
-
-	*bf = 0;	/* Clear transfer byte counter */
-	res = validate(&fp->obj, &fs);		/* Check validity of the file object */
-	if (res != FR_OK || (res = (FRESULT)fp->err) != FR_OK) LEAVE_FF(fs, res);
-	if (!(fp->flag & FA_READ)) LEAVE_FF(fs, FR_DENIED);	/* Check access mode */
+	DIR dj;
+	FFOBJID obj;
+	FFDIDX *ip;
 
-	remain = fp->obj.objsize - fp->fptr;
-	if (btf > remain) btf = (UINT)remain;			/* Truncate btf by remaining bytes */
 
-	for ( ; btf > 0 && (*func)(0, 0); fp->fptr += rcnt, *bf += rcnt, btf -= rcnt) {	/* Repeat until all data transferred or stream goes busy */
-		csect = (UINT)(fp->fptr / SS(fs) & (fs->csize - 1));	/* Sector offset in the cluster */
-		if (fp->fptr % SS(fs) == 0) {				/* On the sector boundary? */
-			if (csect == 0) {						/* On the cluster boundary? */
-				clst = (fp->fptr == 0) ?			/* On the top of the file? */
-					fp->obj.sclust : get_fat(&fp->obj, fp->clust);
-				if (clst <= 1) ABORT(fs, FR_INT_ERR);
-				if (clst == 0xFFFFFFFF) ABORT(fs, FR_DISK_ERR);
-				fp->clust = clst;					/* Update current cluster */
-			}
-		}
-		sect = clst2sect(fs, fp->clust);			/* Get current data sector */
-		if (sect == 0) ABORT(fs, FR_INT_ERR);
-		sect += csect;
-#if FF_FS_TINY
-		if (move_window(fs, sect) != FR_OK) ABORT(fs, FR_DISK_ERR);	/* Move sector window to the file data */
-		dbuf = fs->win;
-#else
-		if (fp->sect != sect) {		/* Fill sector cache with file data */
-#if !FF_FS_READONLY
-			if (fp->flag & FA_DIRTY) {		/* Write-back dirty sector cache */
-				if (disk_write(fs->pdrv, fp->buf, fp->sect, 1) != RES_OK) ABORT(fs, FR_DISK_ERR);
-				fp->flag &= (BYTE)~FA_DIRTY;
+	res = f_opendir(&dj, dpath);
+	if (res != FR_OK) return res;
+	obj = dj.obj;
+	f_closedir(&dj);
+	res = validate(&obj, &fs);
+	if (res == FR_OK) {
+		ip = didx_get(fs, obj.sclust);
+		if (ip) {
+			res = move_window(fs, ip->sect);	/* Mark the index closed */
+			if (res == FR_OK) {
+				fs->win[DI_State] = 0;
+				fs->wflag = 1;
+				res = sync_fs(fs);
 			}
-#endif
-			if (disk_read(fs->pdrv, fp->buf, sect, 1) != RES_OK) ABORT(fs, FR_DISK_ERR);
+			ip->sect = 0;
 		}
-		dbuf = fp->buf;
-#endif
-		fp->sect = sect;
-		rcnt = SS(fs) - (UINT)fp->fptr % SS(fs);	/* Number of bytes remains in the sector */
-		if (rcnt > btf) rcnt = btf;					/* Clip it by btr if needed */
-		rcnt = (*func)(dbuf + ((UINT)fp->fptr % SS(fs)), rcnt);	/* Forward the file data */
-		if (rcnt == 0) ABORT(fs, FR_INT_ERR);
 	}
-
-	LEAVE_FF(fs, FR_OK);
+	LEAVE_FF(fs, res);
 }
-#endif /* FF_USE_FORWARD */
+
+#endif /* FF_USE_DIRINDEX */
 
 
 
@@ -6343,6 +9533,11 @@ FRESULT f_mkfs (
 			nsect = sz_fat;		/* Number of FAT sectors */
 			do {	/* Fill FAT sectors */
 				n = (nsect > sz_buf) ? sz_buf : nsect;
+#if FF_USE_ZEROFILL
+				if (nsect < sz_fat && disk_zero(pdrv, sect, nsect)) {	/* Fill rest of the FAT by the device if supported */
+					n = nsect;
+				} else
+#endif
 				if (disk_write(pdrv, buf, sect, (UINT)n) != RES_OK) LEAVE_MKFS(FR_DISK_ERR);
 				memset(buf, 0, ss);	/* Rest of FAT area is initially zero */
 				sect += n; nsect -= n;
@@ -6351,6 +9546,9 @@ FRESULT f_mkfs (
 
 		/* Initialize root directory (fill with zero) */
 		nsect = (fsty == FS_FAT32) ? pau : sz_dir;	/* Number of root directory sectors */
+#if FF_USE_ZEROFILL
+		if (!disk_zero(pdrv, sect, nsect))	/* Fill by the device if supported */
+#endif
 		do {
 			n = (nsect > sz_buf) ? sz_buf : nsect;
 			if (disk_write(pdrv, buf, sect, (UINT)n) != RES_OK) LEAVE_MKFS(FR_DISK_ERR);
@@ -6572,6 +9770,10 @@ TCHAR* f_gets (
 #include <stdarg.h>
 #define SZ_PUTC_BUF	64
 #define SZ_NUM_BUF	32
+#if FF_STRF_DIRECT && !FF_USE_RESERVE
+#error FF_STRF_DIRECT requires FF_USE_RESERVE == 1
+#endif
+#define PUTC_DIRECT	(FF_STRF_DIRECT && !(FF_USE_LFN && FF_LFN_UNICODE))	/* Output to the sector buffer without code conversion */
 
 /*-----------------------------------------------------------------------*/
 /* Put a Character to the File (with sub-functions)                      */
@@ -6588,10 +9790,64 @@ typedef struct {
 	BYTE bs[4];
 	UINT wi, ct;
 #endif
+#if PUTC_DIRECT
+	BYTE *buf;		/* Sector buffer lent by f_reserve() */
+	int sz;			/* Size of buf[] (0:not reserved) */
+#else
 	BYTE buf[SZ_PUTC_BUF];	/* Write buffer */
+#endif
 } putbuff;
 
 
+#if PUTC_DIRECT
+/* Direct write into the sector buffer */
+
+static void putc_bulk (putbuff* pb, const BYTE* s, UINT n)
+{
+	UINT m;
+
+
+	while (n > 0 && pb->idx >= 0) {
+		if (pb->idx == pb->sz) {	/* Buffer is full or not reserved yet? */
+			if (pb->sz > 0 && f_commit(pb->fp, (UINT)pb->sz) != FR_OK) {	/* Put the filled buffer to the file */
+				pb->idx = -1; break;
+			}
+			if (f_reserve(pb->fp, &pb->buf, &m) != FR_OK || m == 0) {	/* Get next buffer at the file pointer */
+				pb->idx = -1; break;
+			}
+			pb->idx = 0; pb->sz = (int)m;
+		}
+		m = (UINT)(pb->sz - pb->idx);
+		if (m > n) m = n;
+		memcpy(pb->buf + pb->idx, s, m);
+		pb->idx += (int)m; pb->nchr += (int)m;
+		s += m; n -= m;
+	}
+}
+
+static void putc_bfd (putbuff* pb, TCHAR c)
+{
+	if (FF_USE_STRFUNC == 2 && c == '\n') {	/* LF -> CRLF conversion */
+		putc_bulk(pb, (const BYTE*)"\r\n", 2);
+	} else if (pb->idx >= 0 && pb->idx < pb->sz) {	/* Put a character if the buffer has room */
+		pb->buf[pb->idx++] = (BYTE)c;
+		pb->nchr++;
+	} else {
+		putc_bulk(pb, (const BYTE*)&c, 1);
+	}
+}
+
+/* Put the characters left in the buffer to the file and return number of characters written */
+
+static int putc_flush (putbuff* pb)
+{
+	if (pb->idx < 0 || (pb->idx > 0 && f_commit(pb->fp, (UINT)pb->idx) != FR_OK)) return -1;
+	return pb->nchr;
+}
+
+#else
+
+
 /* Buffered file write with code conversion */
 
 static void putc_bfd_internal(putbuff* pb, TCHAR c)
@@ -6740,6 +9996,8 @@ static int putc_flush (putbuff* pb)
 	return -1;
 }
 
+#endif
+
 
 /* Initialize write buffer */
 
@@ -6777,10 +10035,22 @@ int f_puts (
 )
 {
 	putbuff pb;
+#if PUTC_DIRECT
+	UINT n;
+#endif
 
 
 	putc_init(&pb, fp);
+#if PUTC_DIRECT
+	while (*str) {
+		for (n = 0; str[n] && (FF_USE_STRFUNC != 2 || str[n] != '\n'); n++) ;	/* Get a run of characters to be put as is */
+		putc_bulk(&pb, (const BYTE*)str, n);
+		str += n;
+		if (*str) putc_bfd(&pb, *str++);	/* Put the line feed */
+	}
+#else
 	while (*str) putc_bfd(&pb, *str++);		/* Put the string */
+#endif
 	return putc_flush(&pb);
 }
 
@@ -6912,6 +10182,42 @@ static void ftoa (
 }
 #endif	/* FF_PRINT_FLOAT && FF_INTDEF == 2 */
 
+#if FF_PRINT_FIXED
+/* Make a numeral string of 32-bit value in reverse order without division */
+
+static UINT dwtoa (
+	char* str,		/* Buffer to output the numeral string (at least 32 chars) */
+	DWORD val,		/* Value to be converted */
+	UINT radix,		/* Radix (2, 8, 10 or 16) */
+	TCHAR chr		/* Type character ('x' for lower case hexadecimal) */
+)
+{
+	static const DWORD pw10[9] = {1000000000, 100000000, 10000000, 1000000, 100000, 10000, 1000, 100, 10};
+	UINT i, n, k;
+	char d;
+
+
+	if (radix == 10) {	/* Decimal: subtract powers of ten */
+		for (k = 0; k < 9 && val < pw10[k]; k++) ;	/* Skip leading zeros */
+		n = i = 10 - k;		/* Number of digits */
+		for ( ; k < 9; k++) {
+			for (d = '0'; val >= pw10[k]; val -= pw10[k]) d++;
+			str[--n] = d;
+		}
+		str[0] = (char)val + '0';
+	} else {			/* Binary, octal or hexadecimal: shift out the digits */
+		n = (radix == 2) ? 1 : (radix == 8) ? 3 : 4;	/* Bits per digit */
+		i = 0;
+		do {
+			d = (char)(val & (radix - 1)) + '0'; val >>= n;
+			if (d > '9') d += (chr == 'x') ? 0x27 : 0x07;
+			str[i++] = d;
+		} while (val);
+	}
+	return i;
+}
+#endif	/* FF_PRINT_FIXED */
+
 
 
 int f_printf (
@@ -6991,6 +10297,12 @@ int f_printf (
 		case 'o':					/* Unsigned octal */
 			radix = 8; break;
 
+#if FF_PRINT_FIXED
+		case 'k':					/* Fixed-point decimal (signed integer scaled by 10^prec) */
+			flag |= 16; chr = 'd';	/* Signed decimal with decimal point */
+			radix = 10; break;
+
+#endif
 		case 'd':					/* Signed decimal */
 		case 'u': 					/* Unsigned decimal */
 			radix = 10; break;
@@ -7050,11 +10362,23 @@ int f_printf (
 		}
 #endif
 		i = 0;
+#if FF_PRINT_FIXED
+		if ((val >> 16 >> 16) == 0) i = dwtoa(str, (DWORD)val, radix, chr);	/* Make it without division if in 32 bits */
+		if (i == 0)
+#endif
 		do {	/* Make an integer number string */
 			digit = (char)(val % radix) + '0'; val /= radix;
 			if (digit > '9') digit += (chr == 'x') ? 0x27 : 0x07;
 			str[i++] = digit;
 		} while (val && i < SZ_NUM_BUF);
+#if FF_PRINT_FIXED
+		if ((flag & 16) && prec > 0) {	/* Insert decimal point into the fixed-point decimal */
+			if (prec > 9) prec = 9;
+			while (i <= (UINT)prec) str[i++] = '0';	/* Zero padding of fractional part */
+			for (j = i++; j > (UINT)prec; j--) str[j] = str[j - 1];
+			str[prec] = '.';
+		}
+#endif
 		if (flag & 1) str[i++] = '-';	/* Sign */
 		/* Write it */
 		for (j = i; !(flag & 2) && j < width; j++) {	/* Leading pads */
@@ -128,6 +128,58 @@ extern const char* VolumeStr[FF_VOLUMES];	/* User defined volume ID table */
 
 
 
+/* End-of-chain hint item (FFEOCH) */
+
+#if !FF_FS_READONLY && FF_FS_EOCHINT
+typedef struct {
+	LBA_t	dsect;			/* Sector containing the directory entry (0:blank item) */
+	WORD	dofs;			/* Offset of the directory entry in the sector */
+	DWORD	sclust;			/* File start cluster */
+	FSIZE_t	fsize;			/* File size at the time the hint was stored */
+	DWORD	lclust;			/* Last cluster of the file */
+} FFEOCH;
+#endif
+
+
+
+/* Directory lookup cache item (FFDCACHE) */
+
+#if FF_FS_DIRCACHE
+typedef struct {
+	DWORD	hash;			/* Hash value of the object name (0:blank item) */
+	DWORD	dclust;			/* Directory start cluster (0:root) */
+	DWORD	ofs;			/* Offset of the entry block in the directory */
+	DWORD	clust;			/* Cluster containing top of the entry block (0:static root directory) */
+	DWORD	dptr;			/* Offset of the SFN entry in the directory */
+} FFDCACHE;
+#endif
+
+
+
+/* Free entry hint item (FFDHINT) */
+
+#if !FF_FS_READONLY && FF_FS_DIRHINT
+typedef struct {
+	DWORD	dclust;			/* Directory start cluster (0:root) */
+	DWORD	ofs;			/* Offset of the entry, all entries in front of it are in use (0:blank item) */
+	DWORD	clust;			/* Cluster containing the entry (0:static root directory) */
+} FFDHINT;
+#endif
+
+
+
+/* Directory index item (FFDIDX) */
+
+#if !FF_FS_READONLY && FF_USE_DIRINDEX
+typedef struct {
+	DWORD	dclust;			/* Directory start cluster (0:root) */
+	LBA_t	sect;			/* Top sector of the index file (0:blank item) */
+	DWORD	nslot;			/* Number of slots in the index */
+} FFDIDX;
+#endif
+
+
+
 /* Filesystem object structure (FATFS) */
 
 typedef struct {
@@ -136,7 +188,7 @@ typedef struct {
 	BYTE	ldrv;			/* Logical drive number (used only when FF_FS_REENTRANT) */
 	BYTE	n_fats;			/* Number of FATs (1 or 2) */
 	BYTE	wflag;			/* win[] status (1:dirty) */
-	BYTE	fsi_flag;		/* Allocation information control (b7:disabled, b0:dirty) */
+	BYTE	fsi_flag;		/* Allocation information control (b7:disabled, b6:not loaded, b0:dirty) */
 	WORD	id;				/* Volume mount ID */
 	WORD	n_rootdir;		/* Number of root directory entries (FAT12/16) */
 	WORD	csize;			/* Cluster size [sectors] */
@@ -152,6 +204,28 @@ typedef struct {
 #if !FF_FS_READONLY
 	DWORD	last_clst;		/* Last allocated cluster (Unknown if >= n_fatent) */
 	DWORD	free_clst;		/* Number of free clusters (Unknown if >= n_fatent-2) */
+#if FF_FS_LAZYFREE
+	DWORD	fr_clst;		/* Next cluster to be counted by f_getfree_step() (0:not counting) */
+	DWORD	fr_cnt;			/* Number of free clusters counted */
+#endif
+#if FF_FS_EOCHINT
+	BYTE	eoch_idx;		/* Next item of eoch[] to be replaced */
+	FFEOCH	eoch[FF_FS_EOCHINT];	/* End-of-chain hint table */
+#endif
+#if FF_FS_SYNCBATCH
+	struct _FIL_* flist;	/* List of the files opened in write mode */
+#endif
+#if FF_FS_DIRHINT
+	BYTE	dh_idx;			/* Next item of dhint[] to be replaced */
+	FFDHINT	dhint[FF_FS_DIRHINT];	/* Free entry hint table */
+#endif
+#if FF_USE_DIRINDEX
+	FFDIDX	didx[FF_USE_DIRINDEX];	/* Directory index table */
+#endif
+#endif
+#if FF_FS_DIRCACHE
+	BYTE	dc_idx;			/* Next item of dcache[] to be replaced */
+	FFDCACHE dcache[FF_FS_DIRCACHE];	/* Directory lookup cache */
 #endif
 #if FF_FS_RPATH
 	DWORD	cdir;			/* Current directory start cluster (0:root) */
@@ -169,6 +243,10 @@ typedef struct {
 	LBA_t	database;		/* Data base sector */
 #if FF_FS_EXFAT
 	LBA_t	bitbase;		/* Allocation bitmap base sector */
+#endif
+#if FF_FS_SOFTMOUNT
+	BYTE	sm_type;		/* FAT sub-type kept by soft unmount (0:not kept) */
+	DWORD	sm_sum;			/* Checksum of the media ID and VBR at mount */
 #endif
 	LBA_t	winsect;		/* Current sector appearing in the win[] */
 	BYTE	win[FF_MAX_SS];	/* Disk access window for Directory, FAT (and file data at tiny cfg) */
@@ -201,7 +279,7 @@ typedef struct {
 
 /* File object structure (FIL) */
 
-typedef struct {
+typedef struct _FIL_ {
 	FFOBJID	obj;			/* Object identifier (must be the 1st member to detect invalid object pointer) */
 	BYTE	flag;			/* File status flags */
 	BYTE	err;			/* Abort flag (error code) */
@@ -211,17 +289,83 @@ typedef struct {
 #if !FF_FS_READONLY
 	LBA_t	dir_sect;		/* Sector number containing the directory entry (not used at exFAT) */
 	BYTE*	dir_ptr;		/* Pointer to the directory entry in the win[] (not used at exFAT) */
+#if FF_FS_SYNCBATCH
+	struct _FIL_* fnext;	/* Next file in the list of writable files */
+#endif
 #endif
 #if FF_USE_FASTSEEK
 	DWORD*	cltbl;			/* Pointer to the cluster link map table (nulled on open, set by application) */
 #endif
+#if FF_USE_PREALLOC
+	DWORD	pa_ncl;			/* Preallocation chunk size [clusters] (0:not in streaming mode) */
+	DWORD	pa_top;			/* Top cluster of the preallocated region */
+	DWORD	pa_len;			/* Number of clusters in the preallocated region (0:no region) */
+	DWORD	pa_ci;			/* Cluster order of the preallocated region from top of the file */
+	DWORD	pa_prev;		/* Cluster linked to the preallocated region (0:top of the file) */
+#endif
+#if FF_FS_AUTOMAP
+	BYTE	am_stat;		/* Automatic cluster map status (0:not built, 1:whole chain, 2:top of chain) */
+	BYTE	am_cnt;			/* Number of fragments in the am_tbl[] */
+	DWORD	am_ncl;			/* Number of clusters in the am_tbl[] */
+	DWORD	am_tbl[FF_FS_AUTOMAP * 2];	/* Automatic cluster map {length, top cluster} of each fragment */
+#endif
 #if !FF_FS_TINY
+#if FF_FS_BUFPOOL
+	BYTE*	buf;			/* Pointer to the pooled data read/write window (NULL:not assigned) */
+#else
 	BYTE	buf[FF_MAX_SS];	/* File private data read/write window */
 #endif
+#endif
 } FIL;
 
 
 
+/* Record log object structure (RECLOG) */
+
+typedef struct {
+	FIL		dat;			/* Data file object */
+	FIL		idx;			/* Index file object (cluster number of each data cluster) */
+	UINT	rsz;			/* Size of a record [byte] */
+	UINT	rps;			/* Number of records per sector */
+	UINT	ss;				/* Sector size [byte] */
+	DWORD	bcs;			/* Cluster size [byte] */
+	DWORD	nrec;			/* Number of records in the log */
+	DWORD	nidx;			/* Number of items in the index file */
+} RECLOG;
+
+
+
+/* Log ring object structure (LOGRING) */
+
+typedef struct {
+	FIL		fil;			/* Segment file object being written */
+	const TCHAR* pat;		/* Segment file name pattern ('#'s are replaced with segment number) */
+	FSIZE_t	ssz;			/* Size of a segment file [byte] */
+	DWORD	seq;			/* Sequence number of the current segment */
+	DWORD	len;			/* Data length recorded in the header of the current segment */
+	UINT	hsz;			/* Size of the segment header (sector size) */
+	UINT	nseg;			/* Number of segments in the ring */
+	UINT	cur;			/* Current segment number */
+#if FF_USE_FASTSEEK
+	DWORD	clmt[4];		/* Cluster link map table of the current segment */
+#endif
+} LOGRING;
+
+
+
+/* Append journal object structure (JOURNAL) */
+
+typedef struct {
+	FIL		fil;			/* Journal file object (accessed by sector while the journal is open) */
+	FIL*	fp;				/* Pointer to the file to be journaled */
+	LBA_t	sect;			/* Top sector of the journal file (header) */
+	DWORD	nslot;			/* Number of entry slots following the header */
+	DWORD	seq;			/* Sequence number of the next entry */
+	DWORD	cseq;			/* Sequence number at the last checkpoint */
+} JOURNAL;
+
+
+
 /* Directory object structure (DIR) */
 
 typedef struct {
@@ -237,6 +381,10 @@ typedef struct {
 #if FF_USE_FIND
 	const TCHAR* pat;		/* Pointer to the name matching pattern */
 #endif
+#if FF_USE_FINDTIME
+	DWORD	tmin, tmax;		/* Timestamp range to be found (in the format of get_fattime()) */
+	DWORD	tcur;			/* Timestamp of the entries being returned */
+#endif
 } DIR;
 
 
@@ -258,6 +406,18 @@ typedef struct {
 
 
 
+/* Bulk directory scan object structure (DIRSCAN) */
+
+typedef struct {
+	DIR		dir;			/* Directory object */
+	BYTE*	buf;			/* Sector buffer (provided by the application) */
+	UINT	nbuf;			/* Size of the sector buffer [sectors] */
+	UINT	nload;			/* Number of sectors loaded in the buffer */
+	LBA_t	bsect;			/* Sector loaded at top of the buffer */
+} DIRSCAN;
+
+
+
 /* Format parameter structure (MKFS_PARM) */
 
 typedef struct {
@@ -309,11 +469,15 @@ FRESULT f_write (FIL* fp, const void* buff, UINT btw, UINT* bw);	/* Write data t
 FRESULT f_lseek (FIL* fp, FSIZE_t ofs);								/* Move file pointer of the file object */
 FRESULT f_truncate (FIL* fp);										/* Truncate the file */
 FRESULT f_sync (FIL* fp);											/* Flush cached data of the writing file */
+FRESULT f_sync_set (FIL* const fps[], UINT nf);						/* Flush cached data of the writing files at a time */
+FRESULT f_sync_all (const TCHAR* path);								/* Flush cached data of all writing files on the drive */
 FRESULT f_opendir (DIR* dp, const TCHAR* path);						/* Open a directory */
 FRESULT f_closedir (DIR* dp);										/* Close an open directory */
 FRESULT f_readdir (DIR* dp, FILINFO* fno);							/* Read a directory item */
 FRESULT f_findfirst (DIR* dp, FILINFO* fno, const TCHAR* path, const TCHAR* pattern);	/* Find first file */
 FRESULT f_findnext (DIR* dp, FILINFO* fno);							/* Find next file */
+FRESULT f_findtime_first (DIR* dp, FILINFO* fno, const TCHAR* path, DWORD tmin, DWORD tmax);	/* Find first file in the timestamp range */
+FRESULT f_findtime_next (DIR* dp, FILINFO* fno);						/* Find next file in the timestamp range */
 FRESULT f_mkdir (const TCHAR* path);								/* Create a sub directory */
 FRESULT f_unlink (const TCHAR* path);								/* Delete an existing file or directory */
 FRESULT f_rename (const TCHAR* path_old, const TCHAR* path_new);	/* Rename/Move a file or directory */
@@ -324,10 +488,32 @@ FRESULT f_chdir (const TCHAR* path);								/* Change current directory */
 FRESULT f_chdrive (const TCHAR* path);								/* Change current drive */
 FRESULT f_getcwd (TCHAR* buff, UINT len);							/* Get current directory */
 FRESULT f_getfree (const TCHAR* path, DWORD* nclst, FATFS** fatfs);	/* Get number of free clusters on the drive */
+FRESULT f_getfree_step (const TCHAR* path, UINT nsect, DWORD* nclst);	/* Count free clusters on the drive in steps */
 FRESULT f_getlabel (const TCHAR* path, TCHAR* label, DWORD* vsn);	/* Get volume label */
 FRESULT f_setlabel (const TCHAR* label);							/* Set volume label */
 FRESULT f_forward (FIL* fp, UINT(*func)(const BYTE*,UINT), UINT btf, UINT* bf);	/* Forward data to the stream */
+FRESULT f_reserve (FIL* fp, BYTE** buff, UINT* btr);				/* Get the sector buffer to be written at the file pointer */
+FRESULT f_commit (FIL* fp, UINT btc);								/* Put the data written in the sector buffer to the file */
 FRESULT f_expand (FIL* fp, FSIZE_t fsz, BYTE opt);					/* Allocate a contiguous block to the file */
+FRESULT f_prealloc (FIL* fp, FSIZE_t csz);							/* Set streaming mode with contiguous preallocation to the file */
+FRESULT f_rlog_open (RECLOG* rl, const TCHAR* dpath, const TCHAR* ipath, UINT rsz);	/* Open or create a record log */
+FRESULT f_rlog_append (RECLOG* rl, const void* buff, UINT nr);		/* Append records to the record log */
+FRESULT f_rlog_read (RECLOG* rl, DWORD rn, void* buff, UINT nr, UINT* rr);	/* Read records from the record log */
+FRESULT f_rlog_sync (RECLOG* rl);									/* Flush cached data of the record log */
+FRESULT f_rlog_close (RECLOG* rl);									/* Close the record log */
+FRESULT f_ring_open (LOGRING* lr, const TCHAR* pat, UINT nseg, FSIZE_t ssz);	/* Open or create a log ring */
+FRESULT f_ring_write (LOGRING* lr, const void* buff, UINT btw, UINT* bw);	/* Write data to the log ring */
+FRESULT f_ring_sync (LOGRING* lr);									/* Flush cached data of the log ring */
+FRESULT f_ring_close (LOGRING* lr);									/* Close the log ring */
+FRESULT f_jnl_open (JOURNAL* jn, FIL* fp, const TCHAR* path, UINT nslot);	/* Open the journal of the file and replay it */
+FRESULT f_jnl_write (JOURNAL* jn, const void* buff, UINT btw, UINT* bw);	/* Write data to the file with journaling */
+FRESULT f_jnl_checkpoint (JOURNAL* jn);								/* Sync the file and discard the journal entries */
+FRESULT f_jnl_close (JOURNAL* jn);									/* Close the journal */
+FRESULT f_dirscan_open (DIRSCAN* ds, const TCHAR* path, void* buff, UINT btb);	/* Open a directory for bulk scan */
+FRESULT f_dirscan_read (DIRSCAN* ds, FILINFO* fno);					/* Read a directory item in bulk scan */
+FRESULT f_dirscan_close (DIRSCAN* ds);								/* Close the directory scan */
+FRESULT f_diridx_attach (FIL* fp, const TCHAR* dpath, const TCHAR* ipath, UINT nslot);	/* Attach an index file to the directory */
+FRESULT f_diridx_detach (const TCHAR* dpath);							/* Detach the index file from the directory */
 FRESULT f_mount (FATFS* fs, const TCHAR* path, BYTE opt);			/* Mount/Unmount a logical drive */
 FRESULT f_mkfs (const TCHAR* path, const MKFS_PARM* opt, void* work, UINT len);	/* Create a FAT volume */
 FRESULT f_fdisk (BYTE pdrv, const LBA_t ptbl[], void* work);		/* Divide a physical drive into some partitions */
@@ -345,8 +531,10 @@ TCHAR* f_gets (TCHAR* buff, int len, FIL* fp);						/* Get a string from the fil
 #define f_size(fp) ((fp)->obj.objsize)
 #define f_rewind(fp) f_lseek((fp), 0)
 #define f_rewinddir(dp) f_readdir((dp), 0)
+#define f_rlog_count(rl) ((rl)->nrec)
 #define f_rmdir(path) f_unlink(path)
 #define f_unmount(path) f_mount(0, path, 0)
+#define f_unmount_soft(path) f_mount(0, path, 1)
 
 
 
@@ -360,6 +548,11 @@ TCHAR* f_gets (TCHAR* buff, int len, FIL* fp);						/* Get a string from the fil
 DWORD get_fattime (void);	/* Get current time */
 #endif
 
+/* Extent statistics function (provided by user) */
+#if FF_FS_EXTENT == 2
+void ff_extent_stat (BYTE pdrv, UINT nsect, BYTE wr);	/* Notify a direct multi-sector transfer */
+#endif
+
 
 /* LFN support functions (defined in ffunicode.c) */
 
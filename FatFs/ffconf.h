@@ -30,6 +30,16 @@
 /  f_findnext(). (0:Disable, 1:Enable 2:Enable with matching altname[] too) */
 
 
+#define FF_USE_FINDTIME	0
+/* This option switches timestamp filtered directory read functions,
+/  f_findtime_first() and f_findtime_next(). (0:Disable, 1:Enable with last
+/  modified time or 2:Enable with created time) The timestamp of each entry is
+/  compared in the raw directory entry and the file information is created only
+/  for the matched entries. The matched entries are returned in order of the
+/  timestamp (in order of the directory for the same timestamp), and the
+/  directory is scanned once for each different timestamp. */
+
+
 #define FF_USE_MKFS		0
 /* This option switches f_mkfs(). (0:Disable or 1:Enable) */
 
@@ -42,6 +52,23 @@
 /* This option switches f_expand(). (0:Disable or 1:Enable) */
 
 
+#define FF_USE_SYNCSET	0
+/* This option switches f_sync_set() and f_sync_all(). (0:Disable or 1:Enable)
+/  f_sync_set() flushes the cached data of the given files on a volume and
+/  updates their directory entries, and then flushes the filesystem with only one
+/  CTRL_SYNC at the end. f_sync_all() does it for all files opened in write mode
+/  on the volume and is available only when FF_FS_SYNCBATCH == 1. */
+
+
+#define FF_USE_PREALLOC	0
+/* This option switches f_prealloc(). (0:Disable or 1:Enable)
+/  f_prealloc() sets the file in streaming mode. The clusters are allocated in
+/  contiguous chunks ahead of the write pointer and f_write() writes the data
+/  across the clusters in the chunk without access to the FAT. The unused part of
+/  the last chunk is released at f_close(). This function is not supported on the
+/  exFAT volume. */
+
+
 #define FF_USE_CHMOD	0
 /* This option switches attribute control API functions, f_chmod() and f_utime().
 /  (0:Disable or 1:Enable) Also FF_FS_READONLY needs to be 0 to enable this option. */
@@ -56,6 +83,69 @@
 /* This option switches f_forward(). (0:Disable or 1:Enable) */
 
 
+#define FF_USE_RESERVE	0
+/* This option switches f_reserve() and f_commit(). (0:Disable or 1:Enable)
+/  f_reserve() lends the sector buffer of the file at the file pointer to the
+/  application and f_commit() puts the data written into the buffer to the file,
+/  so that the data can be formatted in the buffer without copy. No other file
+/  function should be called between them. */
+
+
+#define FF_USE_RECLOG	0
+/* This option switches record log functions, f_rlog_open(), f_rlog_append(),
+/  f_rlog_read(), f_rlog_sync() and f_rlog_close(). (0:Disable or 1:Enable)
+/  A record log stores fixed-size binary records in a data file without records
+/  straddling sectors, and keeps the cluster number of each data cluster in a
+/  sidecar index file, so that any record can be located without following the
+/  FAT chain of the data file. The index is checked against the FAT chain and
+/  repaired at f_rlog_open(). FF_FS_MINIMIZE must be 0 to enable this option. */
+
+
+#define FF_USE_LOGRING	0
+/* This option switches log ring functions, f_ring_open(), f_ring_write(),
+/  f_ring_sync() and f_ring_close(). (0:Disable or 1:Enable)
+/  A log ring writes the log into a ring of segment files of fixed size, which
+/  are allocated in contiguous at f_ring_open(), and reuses the oldest segment
+/  when the current one is filled up, so that no cluster is allocated while
+/  logging. The first sector of each segment holds the header (sequence number
+/  and length of the data). FF_USE_EXPAND == 1 and FF_FS_MINIMIZE == 0 are
+/  needed to enable this option, and FF_USE_FASTSEEK == 1 eliminates FAT access
+/  while logging. */
+
+
+#define FF_USE_JOURNAL	0
+/* This option switches append journal functions, f_jnl_open(), f_jnl_write(),
+/  f_jnl_checkpoint() and f_jnl_close(). (0:Disable or 1:Enable)
+/  f_jnl_write() writes the data to the file and records it in a journal file
+/  allocated in contiguous, one sector per entry, so that the data is saved with
+/  a sector write instead of f_sync(). The file is synced only at checkpoint and
+/  f_jnl_open() replays the entries not synced yet into the file after power
+/  failure. FF_USE_EXPAND == 1 and FF_FS_MINIMIZE == 0 are needed to enable this
+/  option. */
+
+
+#define FF_USE_DIRSCAN	0
+/* This option switches bulk directory scan functions, f_dirscan_open(),
+/  f_dirscan_read() and f_dirscan_close(). (0:Disable or 1:Enable)
+/  f_dirscan_read() works as f_readdir() but loads the directory table into a
+/  buffer given by the application with a multi-sector read per cluster instead
+/  of a single-sector read per sector. FF_FS_MINIMIZE <= 1 is needed to enable
+/  this option. On the exFAT volume, it reads the directory as f_readdir(). */
+
+
+#define FF_USE_DIRINDEX	0
+/* This option defines number of directories that can be indexed at a time on
+/  each volume, and switches f_diridx_attach() and f_diridx_detach(). (0:Disable
+/  or 1-8) An attached directory has a hash table of its entries in a contiguous
+/  index file and the object name is looked up in the table instead of searching
+/  the directory from top. The table is updated on creating, removing and
+/  renaming the objects in the directory. The index is rebuilt by scanning the
+/  directory at every attach, so the directory can be modified by other systems
+/  while it is detached, but not while it is attached. Each item occupies 12
+/  bytes in the filesystem object (FATFS). FF_USE_LFN == 0, FF_USE_EXPAND == 1
+/  and FF_FS_MINIMIZE == 0 are needed to enable this option. */
+
+
 #define FF_USE_STRFUNC	2
 #define FF_PRINT_LLI	0
 #define FF_PRINT_FLOAT	0
@@ -80,6 +170,25 @@
 */
 
 
+#define FF_STRF_DIRECT	0
+/* This option switches direct output of f_putc(), f_puts() and f_printf() to
+/  the sector buffer of the file. (0:Disable or 1:Enable) When enabled, the
+/  characters are put into the sector buffer lent by f_reserve() instead of via
+/  the intermediate buffer on the stack and f_write(), and f_puts() puts each run
+/  of characters between line feeds in bulk. This option requires FF_USE_RESERVE
+/  == 1 and has no effect when the character encoding needs to be converted
+/  (FF_LFN_UNICODE >= 1 with LFN enabled). */
+
+
+#define FF_PRINT_FIXED	0
+/* FF_PRINT_FIXED = 1 makes f_printf() support fixed-point decimal "%k" and make
+/  numeral strings of 32-bit values without division, which is very slow on the
+/  8-bit MCUs. The argument of "%k" is a signed integer scaled by 10 to the power
+/  of the precision (up to 9), e.g. f_printf(fp, "%.3k", 12345) puts "12.345".
+/  Flags, width and size prefix are available as well as "%d". This feature needs
+/  neither floating point arithmetic nor C99. */
+
+
 /*---------------------------------------------------------------------------/
 / Locale and Namespace Configurations
 /---------------------------------------------------------------------------*/
@@ -219,6 +328,14 @@
 /  the disk_ioctl(). */
 
 
+#define FF_USE_ZEROFILL	0
+/* This option switches support for zero-fill by the device. (0:Disable or 1:Enable)
+/  When enabled, dir_clear() and f_mkfs() ask the disk_ioctl() to fill a block
+/  of sectors with zero by CTRL_ZERO command instead of sending the zero sectors
+/  from the window one by one. If the command fails, they fall back to writing
+/  the sectors. */
+
+
 
 /*---------------------------------------------------------------------------/
 / System Configurations
@@ -263,6 +380,116 @@
 */
 
 
+#define FF_FS_LAZYFREE	0
+/* This option switches lazy loading of the allocation information and
+/  f_getfree_step(). (0:Disable or 1:Enable) When enabled, the FSINFO sector is
+/  not read at mount but prior to the first cluster allocation, and the free
+/  cluster count not available at mount is counted by f_getfree_step() in
+/  bounded steps, e.g. in the idle loop of the application, instead of the
+/  full FAT scan at the first f_getfree(). */
+
+
+#define FF_FS_EOCHINT	0
+/* This option defines number of items in the end-of-chain hint table of each
+/  volume. (0:Disable or 1-16) When a file is opened with FA_OPEN_APPEND, f_open()
+/  needs to follow the cluster chain to the end of the file and it takes a time in
+/  proportion to the file size. When this feature is enabled, the last cluster of
+/  the recently closed files is kept in the filesystem object and f_open() skips
+/  the chain walk if the directory entry, start cluster and file size are not
+/  changed. Each item occupies about 20 bytes in the filesystem object (FATFS). This
+/  option has no effect in read-only configuration and on the exFAT volume. */
+
+
+#define FF_FS_AUTOMAP	0
+/* This option defines number of fragments in the automatic cluster map of each
+/  file object. (0:Disable or 1-255) When enabled, the file object keeps a map of
+/  its cluster chain. The map is built by the first f_lseek() that needs to follow
+/  the cluster chain (or by an append open that follows the chain) and it is kept
+/  up to date as the file is extended. Then f_lseek() and f_read() get the cluster
+/  from the map instead of following the FAT. If the file has more fragments than
+/  the map can hold, only top of the file is mapped. Unlike fast seek feature, the
+/  file size can be expanded. Each fragment occupies 8 bytes in the file object
+/  (FIL). */
+
+
+#define FF_FS_DIRCACHE	0
+/* This option defines number of items in the directory lookup cache of each
+/  volume. (0:Disable or 1-16) Every f_open() and f_stat() searches the directory
+/  for the object name from top of the directory. When this feature is enabled,
+/  location of the recently found directory entries is kept in the filesystem
+/  object and the search goes directly to the entry block if the name is in the
+/  cache. The cache is flushed when any directory entry is created or removed.
+/  Each item occupies 20 bytes in the filesystem object (FATFS). This option has
+/  no effect on the exFAT volume. */
+
+
+#define FF_FS_DIRHINT	0
+/* This option defines number of items in the free entry hint table of each
+/  volume. (0:Disable or 1-16) To create an object, the directory is searched for
+/  free entries from top of the directory, so that it takes a time in proportion
+/  to the number of items in the directory. When this feature is enabled, the
+/  location in front of which all entries are in use is kept for the recently
+/  modified directories and the search starts at there. Each item occupies 12
+/  bytes in the filesystem object (FATFS). This option has no effect in read-only
+/  configuration and on the exFAT volume. */
+
+
+#define FF_FS_SOFTMOUNT	0
+/* This option switches soft unmount feature. (0:Disable or 1:Enable)
+/  When enabled, f_unmount_soft() flushes the cached data and unregisters the
+/  filesystem object but keeps the parsed volume parameters in it. When the same
+/  filesystem object is registered again, the volume is resumed without
+/  re-initializing the drive and re-loading the BPB and FSInfo, only if the drive
+/  has been kept initialized and checksum of the media ID and VBR is not changed.
+/  To check the media ID, GET_MEDIA_ID command should be implemented to the
+/  disk_ioctl(). If not implemented, only the VBR is checked. */
+
+
+#define FF_FS_BUFPOOL	0
+/* This option defines number of sector buffers shared among file objects.
+/  (0:Disable or 1-16) When enabled, the file object (FIL) does not have its own
+/  sector buffer but borrows one from the pool on each read/write access. If all
+/  buffers are in use, the least recently used one is taken from another file
+/  after its dirty data is written back. This allows more files to be opened than
+/  the number of buffers, at the cost of re-reading the sector after eviction.
+/  A buffer lent out by f_reserve() is not evicted until f_commit(). Opened files
+/  must be closed by f_close() to return the buffer to the pool. This option must
+/  be 0 when FF_FS_TINY is 1. */
+
+
+#define FF_FS_SYNCBATCH	0
+/* This option switches batched directory update at f_sync(). (0:Disable or
+/  1:Enable) When enabled, the filesystem object keeps a list of the files opened
+/  in write mode, and f_sync() updates the directory entries of all modified files
+/  in the same directory sector at a time, with writing back their cached data.
+/  Subsequent f_sync() to the other files completes without any disk access if
+/  they have not been modified since then. Also the directory entry is not
+/  rewritten if it is already current. Opened files must be closed by f_close()
+/  to be removed from the list. This option must be 0 when FF_FS_READONLY is 1
+/  and has no effect on the exFAT volume. */
+
+
+#define FF_FS_READAHEAD	0
+/* This option switches sequential read-ahead in f_read() and sets the number of
+/  sectors to be read ahead. (0:Disable or 2-16) When f_read() loads a sector
+/  to the sector buffer of the file in sequential access, it reads the following
+/  sectors in a multi-sector read into a read-ahead buffer shared by all files,
+/  following the cluster chain as long as the next cluster is physically
+/  adjacent. Subsequent sectors are taken from the read-ahead buffer. This option
+/  must be 0 at tiny configuration and takes FF_FS_READAHEAD * FF_MAX_SS bytes of
+/  memory. */
+
+
+#define FF_FS_EXTENT	0
+/* This option switches merging of physically contiguous clusters into a disk
+/  access in f_read() and f_write(). (0:Disable, 1:Enable or 2:Enable with hook)
+/  When enabled, a direct multi-sector transfer is not clipped at the cluster
+/  boundary if the next cluster follows on the disk. When FF_FS_EXTENT == 2,
+/  FatFs calls user provided function ff_extent_stat() with the number of
+/  sectors of each direct multi-sector transfer, so that the application can
+/  obtain the average extent length. */
+
+
 #define FF_FS_LOCK		0
 /* The option FF_FS_LOCK switches file lock function to control duplicated file open
 /  and illegal operation to open objects. This option must be 0 when FF_FS_READONLY
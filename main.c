@@ -84,7 +84,7 @@ void loop()
 		f_close(&fp);
 	}
 
-	f_unmount("0:");
+	f_unmount_soft("0:");
 	
 	__delay_ms(1000);
 }